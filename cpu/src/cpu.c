@@ -27,26 +27,183 @@
 #include <glib.h>
 #include <j4status-plugin-input.h>
 
-#include <stdlib.h> // strtoul()
-#include <string.h> // memcmp(), memset()
-#include <unistd.h> // access()
+#include <errno.h> // errno
+#include <fcntl.h> // open()
+#include <string.h> // memcmp(), strncmp(), strchr(), strrchr(), memset(), memcpy()
+#include <unistd.h> // access(), pread(), lseek(), close(), sysconf(), syscall()
+#include <sys/syscall.h> // SYS_getdents64
 
-/// Number of (used) entries for "cpu" line in PROC_STAT
-#define NUM_ENTRIES 8
+/// Number of (used) entries for "cpu" lines in PROC_STAT
+#define NUM_ENTRIES 9
+
+/// Initial size of the buffer PROC_STAT is read into, per "cpu" line
+/// A line is way shorter than that; the buffer grows if needed anyway
+#define STAT_LINE_SIZE 256
+
+/// Size in bytes of a sparkline cell (all cells are U+2581 to U+2588 blocks
+/// or U+2007 figure space, three bytes each in UTF-8)
+#define SPARK_CELL_SIZE 3
+
+/// Size of the buffer /proc entries are read into by getdents64()
+/// Enough for a thousand processes per call
+#define DENTS_SIZE 32768
+
+/// Size of the buffer a /proc/<pid>/stat file is read into
+/// utime and stime come way before the end of the line
+#define PID_STAT_SIZE 512
+
+/// Length of a process name, including the nul byte (TASK_COMM_LEN)
+#define COMM_SIZE 16
+
+/// Scans between two reads of an idle process
+/// Most processes sleep, busy ones are read on every scan
+#define IDLE_SCAN_PERIOD 4
+
+/// load history of a slot
+/// Samples and sparkline cells live in context-wide arrays
+typedef struct
+{
+    gfloat *samples; // ring of history_size samples
+    // Each cell is written twice, at head and head + history_size,
+    // so that the last history_size cells are always contiguous
+    gchar *spark;
+    guint head; // next sample to write
+    guint count; // number of valid samples
+    gdouble ema;
+} J4statusCPUHistory;
+
+/// other /proc/stat lines we care about
+enum J4statusCPUSchedEntry
+{
+    SCHED_INTR, // only the total, which comes first
+    SCHED_CTXT,
+    SCHED_PROCESSES, // forks since boot
+    SCHED_RUNNING,
+    SCHED_BLOCKED,
+
+    SCHED_ENTRY_COUNT
+};
+
+/// cpu.stat entries we care about
+enum J4statusCPUCGroupEntry
+{
+    CGROUP_USAGE,
+    CGROUP_USER,
+    CGROUP_SYSTEM,
+    CGROUP_NR_THROTTLED,
+    CGROUP_THROTTLED,
+
+    CGROUP_ENTRY_COUNT
+};
+
+/// a cgroup v2 section
+typedef struct
+{
+    J4statusSection *section;
+    gchar *path; // cpu.stat
+    gint fd; // path, kept open while started and the cgroup exists
+    gint64 time; // of the last sample, monotonic
+    guint64 counters[CGROUP_ENTRY_COUNT];
+    gchar buffer[512]; // cpu.stat is a few short lines
+} J4statusCPUCGroup;
+
+/// a process seen by the top scan
+typedef struct
+{
+    guint32 pid;
+    gboolean gone; // dropped from the index at the end of the scan
+    gboolean busy; // running, or used CPU time, when last read
+    gulong ticks; // utime + stime
+    gint64 time; // of the last read, monotonic, 0 if never
+    gchar comm[COMM_SIZE];
+} J4statusCPUProcess;
+
+/// an entry of the top list
+typedef struct
+{
+    gdouble load; // in percent of one CPU
+    gchar comm[COMM_SIZE];
+} J4statusCPUTopEntry;
+
+/// getdents64() record, glibc only got a wrapper in 2.30
+struct J4statusCPUDirent
+{
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    gchar d_name[];
+};
 
 /// implementation of J4statusPluginContext
 struct _J4statusPluginContext
 {
-    J4statusSection *section;
+    guint num_slots; // slot 0 is the "cpu" line, slot N + 1 is "cpuN"
+    J4statusSection **sections; // per slot, NULL if not displayed
     gboolean started;
-    guint period;
-    gulong time1[NUM_ENTRIES], time2[NUM_ENTRIES];
+    guint interval; // current one, in milliseconds
+    guint timeout_id;
+    // adaptive polling, see _j4status_cpu_adapt()
+    gboolean adaptive;
+    guint fast_interval;
+    guint slow_interval;
+    gdouble adaptive_delta;
+    guint adaptive_samples;
+    guint stable_samples;
+    gdouble last_load;
+    // wakeup accounting
+    guint64 wakeups;
+    gint64 start_time;
+    J4statusFormatString *format;
+    guint64 used_tokens;
+    gint fd; // PROC_STAT, kept open while started
+    gchar *buffer;
+    gsize buffer_size;
+    // The counters are stored as NUM_ENTRIES rows of num_slots columns
+    // so that deltas are computed in tight per-entry loops over all slots
+    gulong *counters; // both time and old_time
     gulong *time;
     union
       {
         gulong *old_time;
         gulong *new_time;
       };
+    gboolean *online; // per slot, whether it was found in the last read
+    // the other lines, only parsed if a token needs them
+    guint64 sched[SCHED_ENTRY_COUNT];
+    guint64 new_sched[SCHED_ENTRY_COUNT];
+    gint64 sched_time; // of the last read, monotonic
+    gdouble sched_rates[SCHED_ENTRY_COUNT]; // per second, or as is for gauges
+    gulong *busy; // per slot, scratch
+    gulong *idle; // per slot, scratch
+    guint history_size;
+    gdouble smoothing; // EMA factor
+    J4statusCPUHistory *history; // per slot, NULL if no token needs it
+    gfloat *samples; // num_slots rings of history_size
+    gchar *spark; // num_slots double rings of history_size cells
+    GSList *cgroups;
+    J4statusFormatString *cgroup_format;
+    guint64 cgroup_used_tokens;
+    // top token, see _j4status_cpu_top_scan()
+    guint top_count;
+    glong clock_ticks; // per second, for utime and stime
+    gint proc_fd; // PROC, kept open while started if top is used
+    gint loadavg_fd; // to tell whether processes were created
+    guint64 last_pid; // at the last listing of PROC
+    gchar *dents; // getdents64() buffer
+    GArray *processes; // J4statusCPUProcess sorted by pid
+    guint64 scans; // spreads the reads of idle processes
+    J4statusCPUTopEntry *top; // top_count entries
+    gint64 top_time; // of the last scan, monotonic, 0 before the first
+    GString *top_string;
+    // frequency and temperature, sysfs files kept open while started
+    gint *freq_fds; // per slot, -1 if not available, slot 0 is unused
+    gdouble *freq; // per slot, MHz, 0 if unknown, slot 0 is the average
+    gdouble freq_max;
+    gchar **sensors; // temperature files
+    gint *sensor_fds; // per sensor, -1 if not available
+    gdouble temperature; // hottest sensor, < 0 if unknown
+    gdouble bad_temperature;
 };
 
 /// /proc/stat "cpu" line entries
@@ -60,59 +217,997 @@ enum J4statusCPUStatEntry
     ENTRY_IRQ,
     ENTRY_SOFTIRQ,
     ENTRY_STEAL,
-    ENTRY_GUEST, // unused
-    ENTRY_GUEST_NICE, // not used either
+    ENTRY_GUEST, // already counted in user, so only displayed
+    ENTRY_GUEST_NICE, // not used
+};
+
+/// indices for _j4status_cpu_tokens[]
+enum J4statusCPUToken
+{
+    TOKEN_TOTAL,
+    TOKEN_USER,
+    TOKEN_NICE,
+    TOKEN_SYSTEM,
+    TOKEN_IOWAIT,
+    TOKEN_IRQ,
+    TOKEN_SOFTIRQ,
+    TOKEN_STEAL,
+    TOKEN_GUEST,
+    TOKEN_EMA,
+    TOKEN_MIN,
+    TOKEN_MAX,
+    TOKEN_SPARKLINE,
+    TOKEN_INTERVAL,
+    TOKEN_WAKEUPS,
+    TOKEN_WAKEUP_RATE,
+    TOKEN_TOP,
+    TOKEN_FREQ,
+    TOKEN_FREQ_MAX,
+    TOKEN_TEMP,
+    // in enum J4statusCPUSchedEntry order
+    TOKEN_INTR,
+    TOKEN_CTXT,
+    TOKEN_FORKS,
+    TOKEN_RUNNING,
+    TOKEN_BLOCKED,
+
+    TOTAL_TOKEN_COUNT
+};
+
+/// used in j4status_format_string_parse()
+static const gchar *const _j4status_cpu_tokens[] =
+{
+    [TOKEN_TOTAL]   = "total",
+    [TOKEN_USER]    = "user",
+    [TOKEN_NICE]    = "nice",
+    [TOKEN_SYSTEM]  = "system",
+    [TOKEN_IOWAIT]  = "iowait",
+    [TOKEN_IRQ]     = "irq",
+    [TOKEN_SOFTIRQ] = "softirq",
+    [TOKEN_STEAL]   = "steal",
+    [TOKEN_GUEST]   = "guest",
+    [TOKEN_EMA]     = "ema",
+    [TOKEN_MIN]     = "min",
+    [TOKEN_MAX]     = "max",
+    [TOKEN_SPARKLINE] = "spark",
+    [TOKEN_INTERVAL]  = "interval",
+    [TOKEN_WAKEUPS]   = "wakeups",
+    [TOKEN_WAKEUP_RATE] = "wakeup_rate",
+    [TOKEN_TOP]         = "top",
+    [TOKEN_FREQ]        = "freq",
+    [TOKEN_FREQ_MAX]    = "freq_max",
+    [TOKEN_TEMP]        = "temp",
+    [TOKEN_INTR]        = "intr",
+    [TOKEN_CTXT]        = "ctxt",
+    [TOKEN_FORKS]       = "forks",
+    [TOKEN_RUNNING]     = "running",
+    [TOKEN_BLOCKED]     = "blocked",
+};
+
+/// tokens needing the load history
+#define HISTORY_TOKENS (TOKEN_FLAG(TOKEN_EMA) | TOKEN_FLAG(TOKEN_MIN) \
+                        | TOKEN_FLAG(TOKEN_MAX) | TOKEN_FLAG(TOKEN_SPARKLINE))
+
+/// tokens needing the cpufreq files
+#define FREQ_TOKENS (TOKEN_FLAG(TOKEN_FREQ) | TOKEN_FLAG(TOKEN_FREQ_MAX))
+
+/// tokens needing the whole PROC_STAT, not only the "cpu" lines
+#define SCHED_TOKENS (TOKEN_FLAG(TOKEN_INTR) | TOKEN_FLAG(TOKEN_CTXT) \
+                      | TOKEN_FLAG(TOKEN_FORKS) | TOKEN_FLAG(TOKEN_RUNNING) \
+                      | TOKEN_FLAG(TOKEN_BLOCKED))
+
+/// entry each single-entry token stands for
+static const enum J4statusCPUStatEntry _j4status_cpu_token_entries[] =
+{
+    [TOKEN_USER]    = ENTRY_USER,
+    [TOKEN_NICE]    = ENTRY_NICE,
+    [TOKEN_SYSTEM]  = ENTRY_SYSTEM,
+    [TOKEN_IOWAIT]  = ENTRY_IOWAIT,
+    [TOKEN_IRQ]     = ENTRY_IRQ,
+    [TOKEN_SOFTIRQ] = ENTRY_SOFTIRQ,
+    [TOKEN_STEAL]   = ENTRY_STEAL,
+    [TOKEN_GUEST]   = ENTRY_GUEST,
+};
+
+/// PROC_STAT and cpu.stat keys, a line is "<key> <value>"
+#define STAT_KEY(key) { key, sizeof(key) - 1 }
+typedef struct
+{
+    const gchar *name;
+    gsize length;
+} J4statusCPUStatKey;
+
+/// other PROC_STAT keys
+static const J4statusCPUStatKey _j4status_cpu_sched_keys[] =
+{
+    [SCHED_INTR]      = STAT_KEY("intr"),
+    [SCHED_CTXT]      = STAT_KEY("ctxt"),
+    [SCHED_PROCESSES] = STAT_KEY("processes"),
+    [SCHED_RUNNING]   = STAT_KEY("procs_running"),
+    [SCHED_BLOCKED]   = STAT_KEY("procs_blocked"),
+};
+
+/// cpu.stat keys
+static const J4statusCPUStatKey _j4status_cpu_cgroup_keys[] =
+{
+    [CGROUP_USAGE]        = STAT_KEY("usage_usec"),
+    [CGROUP_USER]         = STAT_KEY("user_usec"),
+    [CGROUP_SYSTEM]       = STAT_KEY("system_usec"),
+    [CGROUP_NR_THROTTLED] = STAT_KEY("nr_throttled"),
+    [CGROUP_THROTTLED]    = STAT_KEY("throttled_usec"),
+};
+
+/// indices for _j4status_cpu_cgroup_tokens[]
+enum J4statusCPUCGroupToken
+{
+    CGROUP_TOKEN_USAGE,
+    CGROUP_TOKEN_USER,
+    CGROUP_TOKEN_SYSTEM,
+    CGROUP_TOKEN_THROTTLED,
+    CGROUP_TOKEN_THROTTLED_TIME,
+
+    CGROUP_TOKEN_COUNT
+};
+
+/// used in j4status_format_string_parse() for cgroup sections
+static const gchar *const _j4status_cpu_cgroup_tokens[] =
+{
+    [CGROUP_TOKEN_USAGE]          = "usage",
+    [CGROUP_TOKEN_USER]           = "user",
+    [CGROUP_TOKEN_SYSTEM]         = "system",
+    [CGROUP_TOKEN_THROTTLED]      = "throttled",
+    [CGROUP_TOKEN_THROTTLED_TIME] = "throttled_time",
+};
+
+/// data for _j4status_cpu_format_callback()
+struct J4statusCPUFormatData
+{
+    guint64 set_tokens;
+    gdouble percent[TOTAL_TOKEN_COUNT];
+    const gchar *spark; // not nul-terminated
+    gsize spark_size;
+    guint interval;
+    guint64 wakeups;
+    gdouble wakeup_rate;
+    const gchar *top;
+    gdouble freq;
+    gdouble freq_max;
+    gdouble temp;
+    const gdouble *sched_rates;
 };
 
 /// the file itself
 #define PROC_STAT_STR "/proc/stat"
 const gchar PROC_STAT[] = PROC_STAT_STR;
 
-
+/// where processes are
+const gchar PROC[] = "/proc";
+
+/// current frequency of a core, in kHz
+const gchar SCALING_CUR_FREQ[] = "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq";
+
+/// where temperature sensors are looked for
+const gchar HWMON[] = "/sys/class/hwmon";
+const gchar THERMAL[] = "/sys/class/thermal";
+
+/// hwmon drivers of processor sensors, all their temp*_input are used
+static const gchar *const _j4status_cpu_hwmon_names[] =
+{
+    "coretemp", // Intel, package and cores
+    "k10temp", // AMD
+    "zenpower", // AMD, out of tree
+    "cpu_thermal", // ARM boards
+    NULL
+};
+
+/// thermal zone types of processor sensors, if no hwmon one is found
+static const gchar *const _j4status_cpu_thermal_types[] =
+{
+    "x86_pkg_temp",
+    "cpu-thermal",
+    "cpu_thermal",
+    "soc_thermal",
+    NULL
+};
+
+/// cgroup v2 hierarchy root
+const gchar CGROUP_ROOT[] = "/sys/fs/cgroup";
+
+/// sparkline cells, from empty to full
+static const gchar _j4status_cpu_spark_cells[][SPARK_CELL_SIZE + 1] =
+{
+    "\u2581", "\u2582", "\u2583", "\u2584",
+    "\u2585", "\u2586", "\u2587", "\u2588",
+};
+
+/// sparkline filler for missing samples
+static const gchar _j4status_cpu_spark_blank[] = "\u2007";
+
+/// bit of a token in used_tokens
+#define TOKEN_FLAG(token) (G_GUINT64_CONSTANT(1) << (token))
+
+/// row of an entry in a counters array
+#define ROW(context, counters, entry) ((counters) + (entry) * (context)->num_slots)
+
+
+
+/**
+ * Reads a decimal number, skipping leading blanks
+ * A lightweight strtoul(): no locale, no base detection, no errno
+ * Returns the position right after the number
+ */
+static inline const gchar *
+_j4status_cpu_scan_number(const gchar *marker, guint64 *value)
+{
+    while (*marker == ' ')
+        marker++;
+    guint64 result = 0;
+    while (*marker >= '0' && *marker <= '9')
+        result = result * 10 + (guint64) (*marker++ - '0');
+    *value = result;
+    return marker;
+}
+
+/**
+ * Parses all the "cpu" lines of the buffer in one pass
+ * Returns the position right after the last one
+ */
+static const gchar *
+_j4status_cpu_parse_lines(J4statusPluginContext *context, gulong time[])
+{
+    const gchar *marker = context->buffer;
+    memset(context->online, 0, context->num_slots * sizeof(gboolean));
+    while (strncmp(marker, "cpu", 3) == 0)
+      {
+        marker += 3;
+        guint64 slot = 0;
+        if (*marker != ' ')
+          {
+            marker = _j4status_cpu_scan_number(marker, &slot);
+            slot++;
+          }
+        if (slot < context->num_slots)
+          {
+            // Blanking is only for the case when the line has too few entries
+            for (guint idx = 0; idx < NUM_ENTRIES; idx++)
+              {
+                guint64 value = 0;
+                if (*marker != '\n' && *marker)
+                    marker = _j4status_cpu_scan_number(marker, &value);
+                ROW(context, time, idx)[slot] = value;
+              }
+            context->online[slot] = TRUE;
+          }
+        while (*marker != '\n' && *marker)
+            marker++;
+        if (!*marker)
+            break;
+        marker++;
+      }
+    return marker;
+}
+
+/**
+ * Parses the lines following the "cpu" ones into new_sched
+ * The intr line is thousands of numbers long, only its total is read
+ */
+static void
+_j4status_cpu_parse_sched(J4statusPluginContext *context, const gchar *marker)
+{
+    memset(context->new_sched, 0, sizeof(context->new_sched));
+    while (marker && *marker)
+      {
+        for (guint entry = 0; entry < SCHED_ENTRY_COUNT; entry++)
+          {
+            gsize length = _j4status_cpu_sched_keys[entry].length;
+            if (strncmp(marker, _j4status_cpu_sched_keys[entry].name,
+                        length) == 0 && marker[length] == ' ')
+              {
+                marker = _j4status_cpu_scan_number(marker + length,
+                                                   &context->new_sched[entry]);
+                break;
+              }
+          }
+        marker = strchr(marker, '\n');
+        if (marker)
+            marker++;
+      }
+}
 
 /**
  * Gathers CPU load metrics from /proc/stat
  * Returns FALSE on error
  * Called on start to gather initial numbers
  * and each update for comparsion
+ * The file is kept open and re-read from the start,
+ * so no allocation happens here once the buffer is big enough
  */
 static gboolean
-_j4status_cpu_parse_load(gulong time[])
+_j4status_cpu_parse_load(J4statusPluginContext *context, gulong time[])
 {
-    GIOChannel *pstat = g_io_channel_new_file(PROC_STAT, "r", NULL);
-    if (!pstat)
+    const gchar *marker;
+    while (TRUE)
       {
-        g_warning("Could not open " PROC_STAT_STR " file");
-        return FALSE;
+        gssize size = pread(context->fd, context->buffer,
+                            context->buffer_size - 1, 0);
+        if (size < 0)
+          {
+            g_warning("Error reading " PROC_STAT_STR ": %s",
+                      g_strerror(errno));
+            return FALSE;
+          }
+        context->buffer[size] = '\0';
+
+        // I don't think it's in the specifications, but it's pretty much
+        // standard to start the file with "cpu" entry
+        if (memcmp(context->buffer, "cpu ", 4) != 0)
+          {
+            g_critical("cpu is not in the first line!");
+            return FALSE;
+          }
+        marker = _j4status_cpu_parse_lines(context, time);
+        if ((gsize) size < context->buffer_size - 1)
+            break;
+        // The other lines are only needed for their tokens
+        if (*marker && (context->used_tokens & SCHED_TOKENS) == 0)
+            break;
+        // The file was cut, which may only happen on the first reads
+        context->buffer_size *= 2;
+        context->buffer = g_realloc(context->buffer, context->buffer_size);
+      }
+    if (context->used_tokens & SCHED_TOKENS)
+        _j4status_cpu_parse_sched(context, marker);
+
+    // Offline CPUs keep their counters, so their delta is zero
+    for (guint slot = 0; slot < context->num_slots; slot++)
+        if (!context->online[slot])
+            for (guint idx = 0; idx < NUM_ENTRIES; idx++)
+                ROW(context, time, idx)[slot]
+                    = ROW(context, context->time, idx)[slot];
+    return TRUE;
+}
+
+/**
+ * Accumulates the deltas of an entry into "sum" for all slots
+ * This is the hot loop, kept trivial so that it can be vectorised
+ */
+static inline void
+_j4status_cpu_add_delta(gulong *restrict sum, const gulong *restrict time,
+                        const gulong *restrict old_time, guint num_slots)
+{
+    // overflows are okay here
+    for (guint slot = 0; slot < num_slots; slot++)
+        sum[slot] += time[slot] - old_time[slot];
+}
+
+/**
+ * Pushes a load sample into a slot history
+ * The sparkline gets one new cell, the others are left as is
+ */
+static void
+_j4status_cpu_history_push(J4statusPluginContext *context,
+                           J4statusCPUHistory *history, gdouble load)
+{
+    guint size = context->history_size;
+    history->samples[history->head] = load;
+    history->ema = (history->count == 0) ? load :
+        context->smoothing * load + (1 - context->smoothing) * history->ema;
+    guint level = CLAMP(load * G_N_ELEMENTS(_j4status_cpu_spark_cells) / 100,
+                        0, G_N_ELEMENTS(_j4status_cpu_spark_cells) - 1);
+    const gchar *cell = _j4status_cpu_spark_cells[level];
+    memcpy(history->spark + history->head * SPARK_CELL_SIZE, cell,
+           SPARK_CELL_SIZE);
+    memcpy(history->spark + (history->head + size) * SPARK_CELL_SIZE, cell,
+           SPARK_CELL_SIZE);
+    history->head = (history->head + 1) % size;
+    history->count = MIN(history->count + 1, size);
+}
+
+/**
+ * Fills the history tokens of a slot
+ */
+static void
+_j4status_cpu_history_fill(J4statusPluginContext *context,
+                           const J4statusCPUHistory *history,
+                           struct J4statusCPUFormatData *fdata)
+{
+    fdata->percent[TOKEN_EMA] = history->ema;
+    if (context->used_tokens & (TOKEN_FLAG(TOKEN_MIN) | TOKEN_FLAG(TOKEN_MAX)))
+      {
+        // samples are in a ring, but min and max do not care about order
+        gfloat min = history->samples[0], max = history->samples[0];
+        for (guint idx = 1; idx < history->count; idx++)
+          {
+            min = MIN(min, history->samples[idx]);
+            max = MAX(max, history->samples[idx]);
+          }
+        fdata->percent[TOKEN_MIN] = min;
+        fdata->percent[TOKEN_MAX] = max;
+      }
+    // the oldest cell is at head, its copy being history_size cells later
+    fdata->spark = history->spark + history->head * SPARK_CELL_SIZE;
+    fdata->spark_size = context->history_size * SPARK_CELL_SIZE;
+}
+
+/**
+ * J4statusFormatStringReplaceCallback instance
+ * Most tokens are percentages of the time elapsed
+ */
+static GVariant *
+_j4status_cpu_format_callback(G_GNUC_UNUSED const gchar *token, guint64 value,
+                              gconstpointer user_data)
+{
+    const struct J4statusCPUFormatData *fdata = user_data;
+    if (value >= TOTAL_TOKEN_COUNT || (fdata->set_tokens & TOKEN_FLAG(value)) == 0)
+        return NULL;
+    switch (value)
+      {
+        case TOKEN_SPARKLINE:
+            return g_variant_new_take_string(g_strndup(fdata->spark,
+                                                       fdata->spark_size));
+        case TOKEN_INTERVAL:
+            return g_variant_new_uint32(fdata->interval);
+        case TOKEN_WAKEUPS:
+            return g_variant_new_uint64(fdata->wakeups);
+        case TOKEN_WAKEUP_RATE:
+            return g_variant_new_double(fdata->wakeup_rate);
+        case TOKEN_TOP:
+            return g_variant_new_string(fdata->top);
+        case TOKEN_FREQ:
+            return g_variant_new_double(fdata->freq);
+        case TOKEN_FREQ_MAX:
+            return g_variant_new_double(fdata->freq_max);
+        case TOKEN_TEMP:
+            return g_variant_new_double(fdata->temp);
+        case TOKEN_INTR:
+        case TOKEN_CTXT:
+        case TOKEN_FORKS:
+        case TOKEN_RUNNING:
+        case TOKEN_BLOCKED:
+            return g_variant_new_double(fdata->sched_rates[value - TOKEN_INTR]);
+        default:
+            return g_variant_new_double(fdata->percent[value]);
+      }
+}
+
+/**
+ * J4statusFormatStringReplaceCallback instance
+ * Values are already computed in user_data[]
+ */
+static GVariant *
+_j4status_cpu_cgroup_format_callback(G_GNUC_UNUSED const gchar *token,
+                                     guint64 value, gconstpointer user_data)
+{
+    const gdouble *fdata = user_data;
+    if (value >= CGROUP_TOKEN_COUNT)
+        return NULL;
+    return g_variant_new_double(fdata[value]);
+}
+
+/**
+ * Opens the cpu.stat file of a cgroup
+ * Returns FALSE (quietly, cgroups come and go) if it does not exist
+ */
+static gboolean
+_j4status_cpu_cgroup_open(J4statusCPUCGroup *cgroup)
+{
+    cgroup->fd = open(cgroup->path, O_RDONLY | O_CLOEXEC);
+    cgroup->time = 0;
+    return cgroup->fd >= 0;
+}
+
+/**
+ * GFunc instance
+ * Samples a cgroup cpu.stat through its kept open fd
+ * Usage is a percentage of one CPU, like top does,
+ * throttled is a number of throttling events per second
+ * and throttled_time the percentage of time throttled
+ */
+static void
+_j4status_cpu_cgroup_update(gpointer data, gpointer user_data)
+{
+    J4statusCPUCGroup *cgroup = data;
+    J4statusPluginContext *context = user_data;
+
+    gssize size = -1;
+    if (cgroup->fd >= 0 || _j4status_cpu_cgroup_open(cgroup))
+        size = pread(cgroup->fd, cgroup->buffer, sizeof(cgroup->buffer) - 1, 0);
+    if (size < 0)
+      {
+        // the cgroup was removed, it may come back later
+        if (cgroup->fd >= 0)
+            close(cgroup->fd);
+        cgroup->fd = -1;
+        j4status_section_set_state(cgroup->section,
+                                   J4STATUS_STATE_UNAVAILABLE);
+        j4status_section_set_value(cgroup->section, NULL);
+        return;
+      }
+    cgroup->buffer[size] = '\0';
+    gint64 now = g_get_monotonic_time();
+
+    guint64 counters[CGROUP_ENTRY_COUNT] = { 0 };
+    const gchar *marker = cgroup->buffer;
+    while (*marker)
+      {
+        for (guint entry = 0; entry < CGROUP_ENTRY_COUNT; entry++)
+          {
+            gsize length = _j4status_cpu_cgroup_keys[entry].length;
+            if (strncmp(marker, _j4status_cpu_cgroup_keys[entry].name,
+                        length) == 0 && marker[length] == ' ')
+              {
+                marker = _j4status_cpu_scan_number(marker + length,
+                                                   &counters[entry]);
+                break;
+              }
+          }
+        while (*marker && *marker++ != '\n');
       }
-    gchar *line;
-    GIOStatus read = g_io_channel_read_line(pstat, &line, NULL, NULL, NULL);
-    g_io_channel_unref(pstat);
-    if (read != G_IO_STATUS_NORMAL)
+
+    gboolean first = (cgroup->time == 0);
+    gdouble elapsed = MAX(now - cgroup->time, 1);
+    gdouble fdata[CGROUP_TOKEN_COUNT];
+    fdata[CGROUP_TOKEN_USAGE] = 100.0
+        * (counters[CGROUP_USAGE] - cgroup->counters[CGROUP_USAGE]) / elapsed;
+    fdata[CGROUP_TOKEN_USER] = 100.0
+        * (counters[CGROUP_USER] - cgroup->counters[CGROUP_USER]) / elapsed;
+    fdata[CGROUP_TOKEN_SYSTEM] = 100.0
+        * (counters[CGROUP_SYSTEM] - cgroup->counters[CGROUP_SYSTEM]) / elapsed;
+    fdata[CGROUP_TOKEN_THROTTLED] = 1.0 * G_USEC_PER_SEC
+        * (counters[CGROUP_NR_THROTTLED]
+           - cgroup->counters[CGROUP_NR_THROTTLED]) / elapsed;
+    fdata[CGROUP_TOKEN_THROTTLED_TIME] = 100.0
+        * (counters[CGROUP_THROTTLED] - cgroup->counters[CGROUP_THROTTLED])
+        / elapsed;
+    memcpy(cgroup->counters, counters, sizeof(counters));
+    cgroup->time = now;
+    if (first)
       {
-        g_warning("Error reading " PROC_STAT_STR);
-        g_free(line);
+        j4status_section_set_state(cgroup->section,
+                                   J4STATUS_STATE_UNAVAILABLE);
+        j4status_section_set_value(cgroup->section, g_strdup("....."));
+        return;
+      }
+
+    j4status_section_set_state(cgroup->section,
+                               fdata[CGROUP_TOKEN_THROTTLED] > 0 ?
+                               J4STATUS_STATE_BAD : J4STATUS_STATE_NO_STATE);
+    j4status_section_set_value(cgroup->section,
+                               j4status_format_string_replace(
+                                   context->cgroup_format,
+                                   &_j4status_cpu_cgroup_format_callback,
+                                   fdata));
+}
+
+/**
+ * GFunc instance
+ * Closes the cpu.stat file of a cgroup
+ */
+static void
+_j4status_cpu_cgroup_close(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusCPUCGroup *cgroup = data;
+    if (cgroup->fd >= 0)
+        close(cgroup->fd);
+    cgroup->fd = -1;
+}
+
+/**
+ * GDestroyNotify instance
+ * Called on freeing cgroup list
+ */
+static void
+_j4status_cpu_cgroup_free(gpointer data)
+{
+    J4statusCPUCGroup *cgroup = data;
+    _j4status_cpu_cgroup_close(cgroup, NULL);
+    j4status_section_free(cgroup->section);
+    g_free(cgroup->path);
+    g_free(cgroup);
+}
+
+/**
+ * Reads a number from a kept open sysfs file
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_cpu_read_sysfs(gint fd, guint64 *value)
+{
+    gchar buffer[32];
+    gssize size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0)
         return FALSE;
+    buffer[size] = '\0';
+    _j4status_cpu_scan_number(buffer, value);
+    return TRUE;
+}
+
+/**
+ * Reads core frequencies and the hottest temperature
+ * Frequencies of offline cores are unknown, and so skipped in the average
+ */
+static void
+_j4status_cpu_sensors_update(J4statusPluginContext *context)
+{
+    if (context->freq_fds)
+      {
+        gdouble sum = 0;
+        guint count = 0;
+        context->freq_max = 0;
+        for (guint slot = 1; slot < context->num_slots; slot++)
+          {
+            guint64 khz = 0;
+            if (context->freq_fds[slot] >= 0 && context->online[slot])
+                _j4status_cpu_read_sysfs(context->freq_fds[slot], &khz);
+            context->freq[slot] = khz / 1000.0;
+            if (khz == 0)
+                continue;
+            sum += context->freq[slot];
+            count++;
+            context->freq_max = MAX(context->freq_max, context->freq[slot]);
+          }
+        context->freq[0] = count > 0 ? sum / count : 0;
+      }
+
+    if (context->sensor_fds)
+      {
+        context->temperature = -1;
+        for (guint idx = 0; context->sensors[idx]; idx++)
+          {
+            guint64 millidegrees;
+            if (context->sensor_fds[idx] >= 0
+                && _j4status_cpu_read_sysfs(context->sensor_fds[idx],
+                                            &millidegrees))
+                context->temperature = MAX(context->temperature,
+                                           millidegrees / 1000.0);
+          }
       }
+}
+
+/**
+ * Opens the frequency and temperature files, if their tokens are used
+ */
+static void
+_j4status_cpu_sensors_open(J4statusPluginContext *context)
+{
+    if (context->freq_fds)
+        for (guint slot = 1; slot < context->num_slots; slot++)
+          {
+            gchar *path = g_strdup_printf(SCALING_CUR_FREQ, slot - 1);
+            // no cpufreq in most virtual machines
+            context->freq_fds[slot] = open(path, O_RDONLY | O_CLOEXEC);
+            g_free(path);
+          }
+    if (context->sensor_fds)
+        for (guint idx = 0; context->sensors[idx]; idx++)
+          {
+            context->sensor_fds[idx] = open(context->sensors[idx],
+                                            O_RDONLY | O_CLOEXEC);
+            if (context->sensor_fds[idx] < 0)
+                g_warning("Could not open %s: %s", context->sensors[idx],
+                          g_strerror(errno));
+          }
+}
 
-    // I don't think it's in the specifications, but it's pretty much standard
-    // to start the file with "cpu" entry
-    if (memcmp(line, "cpu ", 4) != 0)
+/**
+ * The evil twin of _j4status_cpu_sensors_open()
+ */
+static void
+_j4status_cpu_sensors_close(J4statusPluginContext *context)
+{
+    if (context->freq_fds)
+        for (guint slot = 1; slot < context->num_slots; slot++)
+          {
+            if (context->freq_fds[slot] >= 0)
+                close(context->freq_fds[slot]);
+            context->freq_fds[slot] = -1;
+          }
+    if (context->sensor_fds)
+        for (guint idx = 0; context->sensors[idx]; idx++)
+          {
+            if (context->sensor_fds[idx] >= 0)
+                close(context->sensor_fds[idx]);
+            context->sensor_fds[idx] = -1;
+          }
+}
+
+/**
+ * Finds the first process from pid on, among the count first of the index
+ * Returns its position, count if there is none
+ */
+static guint
+_j4status_cpu_process_find(J4statusPluginContext *context, guint count,
+                           guint32 pid)
+{
+    const J4statusCPUProcess *processes
+        = (const J4statusCPUProcess *) context->processes->data;
+    guint low = 0, high = count;
+    while (low < high)
       {
-        g_critical("cpu is not in the first line!");
-        g_free(line);
+        guint middle = low + (high - low) / 2;
+        if (processes[middle].pid < pid)
+            low = middle + 1;
+        else
+            high = middle;
+      }
+    return low;
+}
+
+/**
+ * GCompareFunc instance
+ * Sorts the index by pid
+ */
+static gint
+_j4status_cpu_process_compare(gconstpointer a, gconstpointer b)
+{
+    const J4statusCPUProcess *process_a = a, *process_b = b;
+    return (process_a->pid > process_b->pid)
+        - (process_a->pid < process_b->pid);
+}
+
+/**
+ * Reads utime + stime, the state and the name of a process
+ * Returns FALSE if the process is gone
+ */
+static gboolean
+_j4status_cpu_top_read(J4statusPluginContext *context, guint32 pid,
+                       gulong *ticks, gboolean *running, gchar comm[COMM_SIZE])
+{
+    gchar buffer[PID_STAT_SIZE];
+    gchar path[32];
+    g_snprintf(path, sizeof(path), "%u/stat", pid);
+
+    gint fd = openat(context->proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return FALSE;
+    gssize size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    close(fd);
+    if (size <= 0)
         return FALSE;
+    buffer[size] = '\0';
+
+    // "pid (comm) state ppid ...", comm may contain anything, even ')'
+    const gchar *start = strchr(buffer, '(');
+    const gchar *end = strrchr(buffer, ')');
+    if (start == NULL || end == NULL || end < start)
+        return FALSE;
+    gsize comm_size = MIN((gsize) (end - start - 1), COMM_SIZE - 1);
+    memcpy(comm, start + 1, comm_size);
+    comm[comm_size] = '\0';
+    *running = (end[1] == ' ' && end[2] == 'R');
+
+    // utime and stime are fields 14 and 15, comm being field 2
+    const gchar *marker = end + 1;
+    for (guint field = 3; field < 14; field++)
+      {
+        while (*marker == ' ')
+            marker++;
+        while (*marker && *marker != ' ')
+            marker++;
       }
-    gchar *marker = line + 4;
-    for (guint idx = 0; idx < NUM_ENTRIES && *marker; idx++)
-        time[idx] = strtoul(marker, &marker, 0);
-    g_free(line);
+    guint64 utime, stime;
+    marker = _j4status_cpu_scan_number(marker, &utime);
+    _j4status_cpu_scan_number(marker, &stime);
+    *ticks = utime + stime;
     return TRUE;
 }
 
+/**
+ * Adds the processes created since the last listing to the index
+ * The last pid allocated, from /proc/loadavg, tells whether there are any
+ */
+static void
+_j4status_cpu_top_list(J4statusPluginContext *context)
+{
+    gchar buffer[PID_STAT_SIZE];
+    gssize size = pread(context->loadavg_fd, buffer, sizeof(buffer) - 1, 0);
+    if (size > 0)
+      {
+        // "0.00 0.01 0.05 1/123 4567"
+        buffer[size] = '\0';
+        const gchar *last = strrchr(g_strchomp(buffer), ' ');
+        guint64 last_pid;
+        _j4status_cpu_scan_number(last ? last : buffer, &last_pid);
+        if (last_pid == context->last_pid)
+            return;
+        context->last_pid = last_pid;
+      }
+
+    if (lseek(context->proc_fd, 0, SEEK_SET) < 0)
+      {
+        g_warning("Error rewinding %s: %s", PROC, g_strerror(errno));
+        return;
+      }
+    // PROC lists pids in order, so new ones mostly go at the end
+    guint known = context->processes->len;
+    gboolean sorted = TRUE;
+    while ((size = syscall(SYS_getdents64, context->proc_fd, context->dents,
+                           DENTS_SIZE)) > 0)
+        for (gssize offset = 0; offset < size;)
+          {
+            const struct J4statusCPUDirent *dirent
+                = (gconstpointer) (context->dents + offset);
+            offset += dirent->d_reclen;
+            if (dirent->d_name[0] < '1' || dirent->d_name[0] > '9')
+                continue;
+
+            guint64 pid;
+            _j4status_cpu_scan_number(dirent->d_name, &pid);
+            guint idx = _j4status_cpu_process_find(context, known, pid);
+            if (idx < known && g_array_index(context->processes,
+                                             J4statusCPUProcess, idx).pid
+                               == pid)
+                continue;
+            if (context->processes->len > 0
+                && g_array_index(context->processes, J4statusCPUProcess,
+                                 context->processes->len - 1).pid > pid)
+                sorted = FALSE;
+            J4statusCPUProcess process = { .pid = pid };
+            g_array_append_val(context->processes, process);
+          }
+    if (size < 0)
+        g_warning("Error reading %s: %s", PROC, g_strerror(errno));
+    if (!sorted)
+        g_array_sort(context->processes, &_j4status_cpu_process_compare);
+}
+
+/**
+ * Keeps the top_count processes with the highest CPU usage
+ * since they were last read
+ * /proc is only listed when processes were created, in big batches
+ * with getdents64(); each read costs an openat(), a pread() and a close(),
+ * so idle processes are only read every IDLE_SCAN_PERIOD scans,
+ * spread by pid, and busy or new ones on every scan
+ */
+static void
+_j4status_cpu_top_scan(J4statusPluginContext *context)
+{
+    gint64 now = g_get_monotonic_time();
+    guint num_top = 0;
+
+    context->scans++;
+    _j4status_cpu_top_list(context);
+    J4statusCPUProcess *processes
+        = (J4statusCPUProcess *) context->processes->data;
+    guint count = context->processes->len;
+    for (guint idx = 0; idx < count; idx++)
+      {
+        J4statusCPUProcess *process = &processes[idx];
+        if (context->top_time != 0 && process->time != 0 && !process->busy
+            && (process->pid + context->scans) % IDLE_SCAN_PERIOD != 0)
+            continue;
+
+        gulong ticks;
+        gboolean running;
+        if (!_j4status_cpu_top_read(context, process->pid, &ticks, &running,
+                                    process->comm))
+          {
+            process->gone = TRUE;
+            continue;
+          }
+        // a process started since the last scan used all of its time since
+        gulong delta = ticks;
+        if (process->time != 0 && process->ticks <= ticks)
+            delta = ticks - process->ticks;
+        gint64 elapsed = now - (process->time != 0 ? process->time
+                                                   : context->top_time);
+        process->ticks = ticks;
+        process->time = now;
+        process->busy = running || delta > 0;
+        if (context->top_time == 0 || delta == 0)
+            continue;
+
+        // deltas are in clock ticks, shown in percent of one CPU like top
+        gdouble load = 100.0 * G_USEC_PER_SEC * delta
+            / (context->clock_ticks * MAX(elapsed, 1));
+        // top_count is small, so a sorted insertion is the way to go
+        guint rank = MIN(num_top, context->top_count - 1);
+        if (num_top == context->top_count && load <= context->top[rank].load)
+            continue;
+        for (; rank > 0 && context->top[rank - 1].load < load; rank--)
+            context->top[rank] = context->top[rank - 1];
+        context->top[rank].load = load;
+        memcpy(context->top[rank].comm, process->comm, COMM_SIZE);
+        num_top = MIN(num_top + 1, context->top_count);
+      }
+
+    // gone processes are dropped
+    guint kept = 0;
+    for (guint idx = 0; idx < count; idx++)
+        if (!processes[idx].gone)
+            processes[kept++] = processes[idx];
+    g_array_set_size(context->processes, kept);
+
+    g_string_truncate(context->top_string, 0);
+    for (guint idx = 0; idx < num_top; idx++)
+        g_string_append_printf(context->top_string, "%s%s %.1f%%",
+                               idx > 0 ? ", " : "", context->top[idx].comm,
+                               context->top[idx].load);
+    context->top_time = now;
+}
+
+/**
+ * Computes the per-second rates of the counters read in new_sched
+ * procs_running and procs_blocked are gauges, kept as is
+ */
+static void
+_j4status_cpu_sched_update(J4statusPluginContext *context)
+{
+    gint64 now = g_get_monotonic_time();
+    gdouble elapsed = MAX(now - context->sched_time, 1);
+    for (guint entry = 0; entry < SCHED_ENTRY_COUNT; entry++)
+        switch (entry)
+          {
+            case SCHED_RUNNING:
+            case SCHED_BLOCKED:
+                context->sched_rates[entry] = context->new_sched[entry];
+                break;
+            default:
+                context->sched_rates[entry] = 1.0 * G_USEC_PER_SEC
+                    * (context->new_sched[entry] - context->sched[entry])
+                    / elapsed;
+          }
+    memcpy(context->sched, context->new_sched, sizeof(context->sched));
+    context->sched_time = now;
+}
+
+static gboolean _j4status_cpu_update(gpointer user_data);
+
+/**
+ * (Re-)arms the update timer
+ * Whole seconds use g_timeout_add_seconds() so that wakeups get grouped
+ * with other timers
+ */
+static void
+_j4status_cpu_schedule(J4statusPluginContext *context, guint interval)
+{
+    context->interval = interval;
+    if (interval % 1000 == 0)
+        context->timeout_id = g_timeout_add_seconds(interval / 1000,
+                                                &_j4status_cpu_update, context);
+    else
+        context->timeout_id = g_timeout_add(interval, &_j4status_cpu_update,
+                                            context);
+}
+
+/**
+ * Adaptive polling
+ * Goes back to fast_interval as soon as the load moves by more than
+ * adaptive_delta, and doubles the interval (up to slow_interval)
+ * after adaptive_samples stable samples in a row
+ * Returns what the update timer should return
+ */
+static gboolean
+_j4status_cpu_adapt(J4statusPluginContext *context, gdouble load)
+{
+    gdouble delta = ABS(load - context->last_load);
+    context->last_load = load;
+    if (!context->adaptive)
+        return G_SOURCE_CONTINUE;
+
+    guint interval = context->interval;
+    if (delta > context->adaptive_delta)
+      {
+        context->stable_samples = 0;
+        interval = context->fast_interval;
+      }
+    else if (++context->stable_samples >= context->adaptive_samples)
+      {
+        context->stable_samples = 0;
+        interval = MIN(2 * interval, context->slow_interval);
+      }
+    if (interval == context->interval)
+        return G_SOURCE_CONTINUE;
+
+    g_debug("cpu: Polling every %ums, %" G_GUINT64_FORMAT " wakeups so far",
+            interval, context->wakeups);
+    _j4status_cpu_schedule(context, interval);
+    return G_SOURCE_REMOVE;
+}
+
 /**
  * GSourceFunc instance
- * Called every "period" seconds
+ * Called every "interval" milliseconds
  * Load percentage is calculated from diff between new & old metrics
  */
 static gboolean
@@ -120,9 +1215,15 @@ _j4status_cpu_update(gpointer user_data)
 {
     J4statusPluginContext *context = user_data;
     if (!context->started) return G_SOURCE_REMOVE;
-    if (!_j4status_cpu_parse_load(context->new_time))
+    context->wakeups++;
+    // all cgroups are sampled in the same tick
+    g_slist_foreach(context->cgroups, &_j4status_cpu_cgroup_update, context);
+    if (!_j4status_cpu_parse_load(context, context->new_time))
       {
-        j4status_section_set_state(context->section, J4STATUS_STATE_BAD);
+        for (guint slot = 0; slot < context->num_slots; slot++)
+            if (context->sections[slot])
+                j4status_section_set_state(context->sections[slot],
+                                           J4STATUS_STATE_BAD);
         return G_SOURCE_CONTINUE;
       }
   {
@@ -130,8 +1231,13 @@ _j4status_cpu_update(gpointer user_data)
     context->old_time = context->time;
     context->time = swap;
   }
-    gulong busy = 0, idle = 0;
-    // overflows are okay here
+    if (context->used_tokens & SCHED_TOKENS)
+        _j4status_cpu_sched_update(context);
+    if (context->proc_fd >= 0)
+        _j4status_cpu_top_scan(context);
+    _j4status_cpu_sensors_update(context);
+    memset(context->busy, 0, context->num_slots * sizeof(gulong));
+    memset(context->idle, 0, context->num_slots * sizeof(gulong));
     for (guint idx = 0; idx < NUM_ENTRIES; idx++)
         switch (idx)
           {
@@ -141,25 +1247,201 @@ _j4status_cpu_update(gpointer user_data)
             case ENTRY_IRQ:
             case ENTRY_SOFTIRQ:
             case ENTRY_STEAL:
-                busy += context->time[idx] - context->old_time[idx];
+                _j4status_cpu_add_delta(context->busy,
+                                        ROW(context, context->time, idx),
+                                        ROW(context, context->old_time, idx),
+                                        context->num_slots);
                 break;
             case ENTRY_IDLE:
             case ENTRY_IOWAIT:
-                idle += context->time[idx] - context->old_time[idx];
+                _j4status_cpu_add_delta(context->idle,
+                                        ROW(context, context->time, idx),
+                                        ROW(context, context->old_time, idx),
+                                        context->num_slots);
                 break;
             default:
                 continue;
           }
-    gdouble load = 100.0 * busy / MAX(idle + busy, 1);
-    j4status_section_set_state(context->section,
-                    load < 50.0 ? J4STATUS_STATE_NO_STATE :
-                    load > 90.0 ? J4STATUS_STATE_BAD : J4STATUS_STATE_AVERAGE);
-    j4status_section_set_value(context->section, g_strdup_printf("%04.1f%%",
-                                                                 load));
-    return G_SOURCE_CONTINUE;
+
+    for (guint slot = 0; slot < context->num_slots; slot++)
+      {
+        J4statusSection *section = context->sections[slot];
+        if (!section)
+            continue;
+        if (!context->online[slot])
+          {
+            j4status_section_set_state(section, J4STATUS_STATE_UNAVAILABLE);
+            j4status_section_set_value(section, g_strdup("Offline"));
+            continue;
+          }
+        gulong busy = context->busy[slot], idle = context->idle[slot];
+        gulong elapsed = MAX(idle + busy, 1);
+        gdouble load = 100.0 * busy / elapsed;
+        struct J4statusCPUFormatData fdata = {
+            .set_tokens = context->used_tokens,
+            .percent[TOKEN_TOTAL] = load,
+            .interval = context->interval,
+            .wakeups = context->wakeups,
+            .top = context->top_string ? context->top_string->str : NULL,
+            .temp = context->temperature,
+            .sched_rates = context->sched_rates,
+        };
+        if (context->freq_fds)
+          {
+            fdata.freq = context->freq[slot];
+            fdata.freq_max = (slot == 0) ? context->freq_max : fdata.freq;
+          }
+        if (fdata.freq == 0)
+            fdata.set_tokens &= ~FREQ_TOKENS;
+        if (fdata.temp < 0)
+            fdata.set_tokens &= ~TOKEN_FLAG(TOKEN_TEMP);
+        if (context->used_tokens & TOKEN_FLAG(TOKEN_WAKEUP_RATE))
+            fdata.wakeup_rate = 60.0 * G_USEC_PER_SEC * context->wakeups
+                / MAX(g_get_monotonic_time() - context->start_time, 1);
+        // Only the single entries actually displayed are looked at
+        for (guint token = TOKEN_TOTAL + 1; token <= TOKEN_GUEST; token++)
+            if (context->used_tokens & TOKEN_FLAG(token))
+              {
+                enum J4statusCPUStatEntry idx
+                    = _j4status_cpu_token_entries[token];
+                fdata.percent[token] = 100.0 / elapsed
+                    * (ROW(context, context->time, idx)[slot]
+                       - ROW(context, context->old_time, idx)[slot]);
+              }
+        if (context->history)
+          {
+            _j4status_cpu_history_push(context, &context->history[slot], load);
+            _j4status_cpu_history_fill(context, &context->history[slot],
+                                       &fdata);
+          }
+        J4statusState state = load < 50.0 ? J4STATUS_STATE_NO_STATE :
+                    load > 90.0 ? J4STATUS_STATE_BAD : J4STATUS_STATE_AVERAGE;
+        // about to be throttled, if not already
+        if (context->temperature >= context->bad_temperature)
+            state = J4STATUS_STATE_BAD;
+        j4status_section_set_state(section, state);
+        j4status_section_set_value(section,
+                                   j4status_format_string_replace(
+                                       context->format,
+                                       &_j4status_cpu_format_callback, &fdata));
+      }
+
+    // the aggregate is always computed
+    gulong elapsed = MAX(context->busy[0] + context->idle[0], 1);
+    return _j4status_cpu_adapt(context, 100.0 * context->busy[0] / elapsed);
+}
+
+
+
+/**
+ * Tells whether the first line of "path" is one of "names"
+ */
+static gboolean
+_j4status_cpu_sysfs_matches(const gchar *path, const gchar *const names[])
+{
+    gchar *contents;
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return FALSE;
+    g_strstrip(contents);
+    gboolean matches = g_strv_contains(names, contents);
+    g_free(contents);
+    return matches;
+}
+
+/**
+ * Looks for processor temperature sensors
+ * hwmon drivers are preferred, as they also have per-core sensors;
+ * thermal zones are the fallback
+ * Returns a NULL-terminated list of files, empty if none was found
+ */
+static gchar **
+_j4status_cpu_sensors_find(void)
+{
+    GPtrArray *sensors = g_ptr_array_new();
+    GDir *dir = g_dir_open(HWMON, 0, NULL);
+    const gchar *entry;
+    while (dir && (entry = g_dir_read_name(dir)))
+      {
+        gchar *device = g_build_filename(HWMON, entry, NULL);
+        gchar *name = g_build_filename(device, "name", NULL);
+        if (_j4status_cpu_sysfs_matches(name, _j4status_cpu_hwmon_names))
+          {
+            GDir *files = g_dir_open(device, 0, NULL);
+            const gchar *file;
+            while (files && (file = g_dir_read_name(files)))
+                if (g_str_has_prefix(file, "temp")
+                    && g_str_has_suffix(file, "_input"))
+                    g_ptr_array_add(sensors,
+                                    g_build_filename(device, file, NULL));
+            if (files)
+                g_dir_close(files);
+          }
+        g_free(name);
+        g_free(device);
+      }
+    if (dir)
+        g_dir_close(dir);
+
+    dir = (sensors->len == 0) ? g_dir_open(THERMAL, 0, NULL) : NULL;
+    while (dir && (entry = g_dir_read_name(dir)))
+      {
+        if (!g_str_has_prefix(entry, "thermal_zone"))
+            continue;
+        gchar *type = g_build_filename(THERMAL, entry, "type", NULL);
+        if (_j4status_cpu_sysfs_matches(type, _j4status_cpu_thermal_types))
+            g_ptr_array_add(sensors,
+                            g_build_filename(THERMAL, entry, "temp", NULL));
+        g_free(type);
+      }
+    if (dir)
+        g_dir_close(dir);
+
+    g_ptr_array_add(sensors, NULL);
+    return (gchar **) g_ptr_array_free(sensors, FALSE);
+}
+
+/**
+ * Creates and inserts a section for a slot
+ * Slot 0 is the aggregate, without instance
+ */
+static void
+_j4status_cpu_add_section(J4statusPluginContext *context,
+                          J4statusCoreInterface *core, guint slot)
+{
+    if (context->sections[slot]) return;
+    J4statusSection *section = j4status_section_new(core);
+    j4status_section_set_name(section, "cpu");
+    if (slot > 0)
+      {
+        gchar *instance = g_strdup_printf("%u", slot - 1);
+        j4status_section_set_instance(section, instance);
+        g_free(instance);
+      }
+    if (j4status_section_insert(section))
+        context->sections[slot] = section;
+    else
+        j4status_section_free(section);
 }
 
-
+/**
+ * Creates and inserts a section for a cgroup
+ * "path" is relative to the cgroup v2 hierarchy root
+ */
+static void
+_j4status_cpu_add_cgroup(J4statusPluginContext *context,
+                         J4statusCoreInterface *core, const gchar *path)
+{
+    J4statusCPUCGroup *cgroup = g_new0(J4statusCPUCGroup, 1);
+    cgroup->fd = -1;
+    cgroup->path = g_build_filename(CGROUP_ROOT, path, "cpu.stat", NULL);
+    cgroup->section = j4status_section_new(core);
+    j4status_section_set_name(cgroup->section, "cpu-cgroup");
+    j4status_section_set_instance(cgroup->section, path);
+    if (j4status_section_insert(cgroup->section))
+        context->cgroups = g_slist_prepend(context->cgroups, cgroup);
+    else
+        _j4status_cpu_cgroup_free(cgroup);
+}
 
 /**
  * J4statusPluginInitFunc instance
@@ -170,55 +1452,252 @@ static J4statusPluginContext *
 _j4status_cpu_init(J4statusCoreInterface *core)
 {
     const gchar CPU_LOAD[] = "CPULoad";
+    const gchar FORMAT_DEFAULT[] = "${total(f04.1)}%";
+    const gchar CGROUP_FORMAT_DEFAULT[] = "${usage(f04.1)}%";
 
     if (access(PROC_STAT, R_OK) < 0)
       {
         g_critical("Could not find " PROC_STAT_STR "; aborting");
         return NULL;
       }
+    glong num_cpus = sysconf(_SC_NPROCESSORS_CONF);
     GKeyFile *key_file = j4status_config_get_key_file(CPU_LOAD);
     gint period = 0;
+    gint interval = 0;
+    gboolean adaptive = FALSE;
+    gint fast_interval = 0;
+    gint slow_interval = 0;
+    gdouble adaptive_delta = 0;
+    gint adaptive_samples = 0;
+    gboolean per_core = FALSE;
+    gint *cores = NULL;
+    gsize num_cores = 0;
+    gchar *format = NULL;
+    gint history_size = 0;
+    gdouble smoothing = 0;
+    gchar **cgroups = NULL;
+    gchar *cgroup_format = NULL;
+    gint top_count = 0;
+    gchar **sensors = NULL;
+    gdouble bad_temperature = 0;
     if (key_file)
       {
         // Lower update frequency also smoothes load metric diffs,
         // so it may be desirable
         period = g_key_file_get_integer(key_file, CPU_LOAD, "Frequency", NULL);
+        interval = g_key_file_get_integer(key_file, CPU_LOAD, "Interval",
+                                          NULL);
+        adaptive = g_key_file_get_boolean(key_file, CPU_LOAD, "Adaptive",
+                                          NULL);
+        fast_interval = g_key_file_get_integer(key_file, CPU_LOAD,
+                                               "FastInterval", NULL);
+        slow_interval = g_key_file_get_integer(key_file, CPU_LOAD,
+                                               "SlowInterval", NULL);
+        adaptive_delta = g_key_file_get_double(key_file, CPU_LOAD,
+                                               "AdaptiveDelta", NULL);
+        adaptive_samples = g_key_file_get_integer(key_file, CPU_LOAD,
+                                                  "AdaptiveSamples", NULL);
+        per_core = g_key_file_get_boolean(key_file, CPU_LOAD, "PerCore", NULL);
+        cores = g_key_file_get_integer_list(key_file, CPU_LOAD, "Cores",
+                                            &num_cores, NULL);
+        format = g_key_file_get_locale_string(key_file, CPU_LOAD, "Format",
+                                              NULL, NULL);
+        history_size = g_key_file_get_integer(key_file, CPU_LOAD,
+                                              "HistorySize", NULL);
+        smoothing = g_key_file_get_double(key_file, CPU_LOAD, "Smoothing",
+                                          NULL);
+        cgroups = g_key_file_get_string_list(key_file, CPU_LOAD, "CGroups",
+                                             NULL, NULL);
+        cgroup_format = g_key_file_get_locale_string(key_file, CPU_LOAD,
+                                                     "CGroupFormat", NULL,
+                                                     NULL);
+        top_count = g_key_file_get_integer(key_file, CPU_LOAD, "TopCount",
+                                           NULL);
+        sensors = g_key_file_get_string_list(key_file, CPU_LOAD, "Sensors",
+                                             NULL, NULL);
+        bad_temperature = g_key_file_get_double(key_file, CPU_LOAD,
+                                                "BadTemperature", NULL);
         g_key_file_free(key_file);
       }
 
-    J4statusSection *section = j4status_section_new(core);
-    j4status_section_set_name(section, "cpu");
-    if (!j4status_section_insert(section))
+    J4statusPluginContext *context = g_new0(J4statusPluginContext, 1);
+    context->num_slots = MAX(num_cpus, 1) + 1;
+    context->sections = g_new0(J4statusSection *, context->num_slots);
+    _j4status_cpu_add_section(context, core, 0);
+    if (per_core)
+        for (guint slot = 1; slot < context->num_slots; slot++)
+            _j4status_cpu_add_section(context, core, slot);
+    for (gsize idx = 0; idx < num_cores; idx++)
       {
-        j4status_section_free(section);
+        if (cores[idx] < 0 || (guint) cores[idx] + 1 >= context->num_slots)
+            g_warning("No such CPU core: %d", cores[idx]);
+        else
+            _j4status_cpu_add_section(context, core, cores[idx] + 1);
+      }
+    g_free(cores);
+    for (gchar **cgroup = cgroups; cgroup && *cgroup; cgroup++)
+        _j4status_cpu_add_cgroup(context, core, *cgroup);
+    g_strfreev(cgroups);
+    context->cgroups = g_slist_reverse(context->cgroups);
+
+    gboolean any = (context->cgroups != NULL);
+    for (guint slot = 0; slot < context->num_slots; slot++)
+        any = any || context->sections[slot];
+    if (!any)
+      {
+        g_strfreev(sensors);
+        g_free(format);
+        g_free(cgroup_format);
+        g_free(context->sections);
+        g_free(context);
         return NULL;
       }
 
-    J4statusPluginContext *context = g_new(J4statusPluginContext, 1);
-    context->section = section;
     context->started = FALSE;
-    context->period = MAX(period, 1);
+    context->timeout_id = 0;
+    context->fd = -1;
+    context->proc_fd = -1;
+    context->loadavg_fd = -1;
+    // Interval (milliseconds) takes precedence over Frequency (seconds)
+    context->interval = interval > 0 ? interval : MAX(period, 1) * 1000;
+    context->adaptive = adaptive;
+    context->fast_interval = fast_interval > 0 ? fast_interval : 250;
+    context->slow_interval = slow_interval > 0 ? (guint) slow_interval :
+                             MAX(context->interval, 5000);
+    context->slow_interval = MAX(context->slow_interval,
+                                 context->fast_interval);
+    context->adaptive_delta = adaptive_delta > 0 ? adaptive_delta : 2.0;
+    context->adaptive_samples = adaptive_samples > 0 ? adaptive_samples : 4;
+    context->format = j4status_format_string_parse(format, _j4status_cpu_tokens,
+                                                   TOTAL_TOKEN_COUNT,
+                                                   FORMAT_DEFAULT,
+                                                   &context->used_tokens);
+    context->cgroup_format = j4status_format_string_parse(cgroup_format,
+                                                   _j4status_cpu_cgroup_tokens,
+                                                   CGROUP_TOKEN_COUNT,
+                                                   CGROUP_FORMAT_DEFAULT,
+                                                   &context->cgroup_used_tokens);
+    context->buffer_size = STAT_LINE_SIZE * context->num_slots;
+    context->buffer = g_new(gchar, context->buffer_size);
+    context->counters = g_new0(gulong, 2 * NUM_ENTRIES * context->num_slots);
+    context->online = g_new0(gboolean, context->num_slots);
+    context->busy = g_new(gulong, context->num_slots);
+    context->idle = g_new(gulong, context->num_slots);
+    context->history_size = history_size > 0 ? history_size : 20;
+    context->smoothing = (smoothing > 0 && smoothing <= 1) ? smoothing : 0.3;
+    if (context->used_tokens & HISTORY_TOKENS)
+      {
+        guint cells = 2 * context->history_size;
+        context->history = g_new0(J4statusCPUHistory, context->num_slots);
+        context->samples = g_new0(gfloat,
+                                  context->num_slots * context->history_size);
+        context->spark = g_new(gchar,
+                               context->num_slots * cells * SPARK_CELL_SIZE);
+        for (guint slot = 0; slot < context->num_slots; slot++)
+          {
+            J4statusCPUHistory *history = &context->history[slot];
+            history->samples = context->samples + slot * context->history_size;
+            history->spark = context->spark + slot * cells * SPARK_CELL_SIZE;
+            for (guint cell = 0; cell < cells; cell++)
+                memcpy(history->spark + cell * SPARK_CELL_SIZE,
+                       _j4status_cpu_spark_blank, SPARK_CELL_SIZE);
+          }
+      }
+    if (context->used_tokens & TOKEN_FLAG(TOKEN_TOP))
+      {
+        context->top_count = top_count > 0 ? top_count : 3;
+        context->clock_ticks = MAX(sysconf(_SC_CLK_TCK), 1);
+        context->dents = g_new(gchar, DENTS_SIZE);
+        // enough for a desktop, it grows on the first scan otherwise
+        context->processes = g_array_sized_new(FALSE, FALSE,
+                                               sizeof(J4statusCPUProcess),
+                                               1024);
+        context->top = g_new0(J4statusCPUTopEntry, context->top_count);
+        context->top_string = g_string_new(NULL);
+      }
+    if (context->used_tokens & FREQ_TOKENS)
+      {
+        context->freq_fds = g_new(gint, context->num_slots);
+        for (guint slot = 0; slot < context->num_slots; slot++)
+            context->freq_fds[slot] = -1;
+        context->freq = g_new0(gdouble, context->num_slots);
+      }
+    context->temperature = -1;
+    context->bad_temperature = bad_temperature > 0 ? bad_temperature : 90;
+    if (context->used_tokens & TOKEN_FLAG(TOKEN_TEMP))
+      {
+        context->sensors = sensors ? sensors : _j4status_cpu_sensors_find();
+        sensors = NULL;
+        if (context->sensors[0] == NULL)
+            g_message("cpu: No temperature sensor found");
+        guint num_sensors = g_strv_length(context->sensors);
+        context->sensor_fds = g_new(gint, num_sensors);
+        for (guint idx = 0; idx < num_sensors; idx++)
+            context->sensor_fds[idx] = -1;
+      }
+    g_strfreev(sensors);
     return context;
 }
 
 /**
  * J4statusPluginSimpleFunc instance
- * Inits the metrics arrays and launches update timer
+ * Opens PROC_STAT, inits the metrics arrays and launches update timer
  */
 static void
 _j4status_cpu_start(J4statusPluginContext *context)
 {
     if (context->started) return;
-    context->time = context->time1;
-    context->old_time = context->time2;
-    // Blanking is only for the case when "cpu" line has too few entries
-    memset(&context->time1, 0, NUM_ENTRIES);
-    memset(&context->time2, 0, NUM_ENTRIES);
-    if (!_j4status_cpu_parse_load(context->time)) return;
+    context->fd = open(PROC_STAT, O_RDONLY | O_CLOEXEC);
+    if (context->fd < 0)
+      {
+        g_warning("Could not open " PROC_STAT_STR ": %s", g_strerror(errno));
+        return;
+      }
+    context->time = context->counters;
+    context->old_time = context->counters + NUM_ENTRIES * context->num_slots;
+    memset(context->counters, 0,
+           2 * NUM_ENTRIES * context->num_slots * sizeof(gulong));
+    if (!_j4status_cpu_parse_load(context, context->time))
+      {
+        close(context->fd);
+        context->fd = -1;
+        return;
+      }
+    memcpy(context->sched, context->new_sched, sizeof(context->sched));
+    context->sched_time = g_get_monotonic_time();
     context->started = TRUE;
-    j4status_section_set_state(context->section, J4STATUS_STATE_UNAVAILABLE);
-    j4status_section_set_value(context->section, g_strdup("....."));
-    g_timeout_add_seconds(context->period, &_j4status_cpu_update, context);
+    for (guint slot = 0; slot < context->num_slots; slot++)
+        if (context->sections[slot])
+          {
+            j4status_section_set_state(context->sections[slot],
+                                       J4STATUS_STATE_UNAVAILABLE);
+            j4status_section_set_value(context->sections[slot],
+                                       g_strdup("....."));
+          }
+    context->wakeups = 0;
+    context->start_time = g_get_monotonic_time();
+    context->stable_samples = 0;
+    context->last_load = 0;
+    // a first sample, so that the first tick already has deltas
+    g_slist_foreach(context->cgroups, &_j4status_cpu_cgroup_update, context);
+    _j4status_cpu_sensors_open(context);
+    if (context->top_string)
+      {
+        context->proc_fd = open(PROC, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (context->proc_fd < 0)
+            g_warning("Could not open %s: %s", PROC, g_strerror(errno));
+        else
+          {
+            context->loadavg_fd = openat(context->proc_fd, "loadavg",
+                                         O_RDONLY | O_CLOEXEC);
+            // a full listing and a full read on the first scan
+            context->last_pid = 0;
+            context->top_time = 0;
+            _j4status_cpu_top_scan(context);
+          }
+      }
+    _j4status_cpu_schedule(context, context->adaptive ?
+                                    context->fast_interval : context->interval);
 }
 
 /**
@@ -229,6 +1708,20 @@ static void
 _j4status_cpu_stop(J4statusPluginContext *context)
 {
     context->started = FALSE;
+    if (context->timeout_id)
+        g_source_remove(context->timeout_id);
+    context->timeout_id = 0;
+    if (context->fd >= 0)
+        close(context->fd);
+    context->fd = -1;
+    if (context->loadavg_fd >= 0)
+        close(context->loadavg_fd);
+    context->loadavg_fd = -1;
+    if (context->proc_fd >= 0)
+        close(context->proc_fd);
+    context->proc_fd = -1;
+    _j4status_cpu_sensors_close(context);
+    g_slist_foreach(context->cgroups, &_j4status_cpu_cgroup_close, NULL);
 }
 
 /**
@@ -239,7 +1732,31 @@ static void
 _j4status_cpu_uninit(J4statusPluginContext *context)
 {
     if (context->started) _j4status_cpu_stop(context);
-    j4status_section_free(context->section);
+    for (guint slot = 0; slot < context->num_slots; slot++)
+        if (context->sections[slot])
+            j4status_section_free(context->sections[slot]);
+    g_free(context->sections);
+    g_slist_free_full(context->cgroups, &_j4status_cpu_cgroup_free);
+    j4status_format_string_unref(context->format);
+    j4status_format_string_unref(context->cgroup_format);
+    g_free(context->buffer);
+    g_free(context->counters);
+    g_free(context->online);
+    g_free(context->busy);
+    g_free(context->idle);
+    g_free(context->history);
+    g_free(context->samples);
+    g_free(context->spark);
+    g_free(context->dents);
+    if (context->processes)
+        g_array_free(context->processes, TRUE);
+    g_free(context->top);
+    if (context->top_string)
+        g_string_free(context->top_string, TRUE);
+    g_free(context->freq_fds);
+    g_free(context->freq);
+    g_strfreev(context->sensors);
+    g_free(context->sensor_fds);
     g_free(context);
 }
 
@@ -25,12 +25,33 @@
 #endif // HAVE_CONFIG_H
 
 #include <glib.h>
+#include <glib-unix.h> // g_unix_fd_add()
 #include <j4status-plugin-input.h>
 
-#include <blkid.h> // blkid_evaluate_tag(), blkid_cache
-#include <unistd.h> // access()
+#include <blkid.h> // blkid_evaluate_tag(), blkid_gc_cache(), blkid_cache
+#include <errno.h> // errno
+#include <fcntl.h> // open()
+#include <stdio.h> // sscanf()
+#include <string.h> // strchr()
+#include <unistd.h> // access(), read(), pread(), lseek(), close()
 #include <mntent.h> // setmntent(), struct mntent, getmntent(), endmntent()
-#include <sys/statvfs.h> // statvfs(), struct statvfs
+#include <sys/socket.h> // socket(), bind(), recvfrom()
+#include <sys/stat.h> // stat(), struct stat
+#include <sys/statvfs.h> // statvfs(), struct statvfs, ST_RDONLY
+#include <sys/sysmacros.h> // makedev(), major(), minor()
+#include <linux/netlink.h> // NETLINK_KOBJECT_UEVENT, struct sockaddr_nl
+
+/// Initial size of the buffer PROC_MOUNTINFO is read into
+/// It grows to fit the mount table on the first read
+#define MOUNTINFO_SIZE 16384
+/// Size of the buffer block device stat files are read into
+#define IO_STAT_SIZE 256
+/// Unit of sectors in block device stat files, whatever the device
+#define IO_SECTOR_SIZE 512
+/// Size of the buffer kernel uevents are read into
+#define UEVENT_SIZE 8192
+/// Netlink group of kernel uevents (udev ones are 2)
+#define UEVENT_GROUP_KERNEL 1
 
 /// implementation of J4statusPluginContext
 struct _J4statusPluginContext
@@ -40,10 +61,90 @@ struct _J4statusPluginContext
     guint period;
     gchar *not_found;
     gchar *unmounted;
+    gchar *stale;
+    GThreadPool *pool; // statvfs() calls, one thread per section at most
     const gchar *mtab;
     blkid_cache cache;
+    // mount index, see _j4status_fsinfo_mounts_rebuild()
+    GArray *mounts; // of J4statusFSInfoMount
+    GStringChunk *mount_strings; // mtab ones, cleared on each rebuild
+    GHashTable *mounts_by_device; // mount source -> first mount
+    GHashTable *mounts_by_path; // mount point -> last (visible) mount
+    GHashTable *mounts_by_devnum; // st_dev -> first mount
+    gint mountinfo_fd; // PROC_MOUNTINFO, -1 to read mtab each tick instead
+    guint watch_id; // POLLPRI on mountinfo_fd
+    GString *mountinfo; // mountinfo ones point here
+    guint mounts_serial; // bumped on each rebuild
+    gint uevent_fd; // kernel uevents, -1 to look devices up each tick instead
+    guint uevent_watch_id;
+    guint devices_serial; // bumped on block device events
+    struct J4statusFSInfoDiscovery *discovery; // NULL if disabled
 };
 
+/// a mount table entry
+/// Strings belong to the mount index, and live until it is rebuilt
+typedef struct
+{
+    gchar *device; // mount source, as in mtab
+    gchar *path;
+    gchar *type;
+    gint64 devnum; // st_dev of the filesystem, 0 if unknown
+} J4statusFSInfoMount;
+
+/// a usage sample
+typedef struct
+{
+    gint64 time; // monotonic
+    guint64 used; // bytes
+} J4statusFSInfoSample;
+
+/// usage history of a section, with running least-squares sums
+/// Sums are of samples relative to the base one, to keep them small enough
+/// for doubles; they are recomputed (and rebased) once per ring wrap,
+/// so rounding errors do not pile up
+typedef struct
+{
+    J4statusFSInfoSample *samples; // ring of size samples
+    guint size;
+    guint head; // next sample to write
+    guint count; // number of valid samples
+    J4statusFSInfoSample base;
+    gdouble sum_t; // seconds
+    gdouble sum_u; // bytes
+    gdouble sum_tt;
+    gdouble sum_tu;
+} J4statusFSInfoHistory;
+
+/// fields of block device stat files used, see Documentation/block/stat.rst
+enum J4statusFSInfoIOField
+{
+    IO_READ_IOS = 0,
+    IO_READ_SECTORS = 2,
+    IO_READ_TICKS = 3, // milliseconds
+    IO_WRITE_IOS = 4,
+    IO_WRITE_SECTORS = 6,
+    IO_WRITE_TICKS = 7,
+    IO_TICKS = 9, // milliseconds the device was busy
+
+    IO_FIELD_COUNT
+};
+
+/// I/O statistics of the block device under a section
+typedef struct
+{
+    gint fd; // its stat file, -1 if none
+    gint64 devnum; // the device fd is open for
+    guint serial; // of the mount index it was resolved with
+    gint64 time; // of the last sample, 0 if none
+    guint64 fields[IO_FIELD_COUNT]; // last sample
+    gboolean valid; // rates below are set
+    gdouble read; // bytes per second
+    gdouble write;
+    gdouble iops;
+    gdouble latency; // milliseconds per request
+    gdouble util; // percentage of time busy
+} J4statusFSInfoIO;
+
 /// derived from J4statusSection
 typedef struct
 {
@@ -57,16 +158,78 @@ typedef struct
       } id_t;
     gchar *id;
     gchar *device;
-    gulong fsid;
     gchar *path;
+    guint devices_serial; // of the device events it was located after
+    gboolean found; // by the last lookup
     J4statusFormatString *format;
     guint64 used_tokens;
+    guint timeout; // seconds a statvfs() call can take before going stale
+    struct J4statusFSInfoJob *job; // in flight, NULL if none
+    J4statusFSInfoHistory history; // of path, reset when it changes
+    J4statusFSInfoHistory inode_history; // same, in inodes
+    J4statusFSInfoIO io;
+    gint64 average_eta; // time to full (in seconds) for an average state
+    gint64 bad_eta; // and for a bad one
+    // discovered sections have no J4statusSection of their own,
+    // they are shown through J4statusFSInfoDiscovery slots
+    gboolean discovered;
+    guint serial; // of the last mount index the mount point was in
+    guint order; // in the mount table
+    J4statusState state;
+    gchar *value; // NULL until updated once
+    gboolean dirty; // changed since last shown
+    guint64 size; // bytes
+    gdouble usage; // used ratio, negative until known
 } J4statusFSInfoSection;
 
+/// a discovered section on display
+typedef struct
+{
+    J4statusSection *section;
+    J4statusFSInfoSection *shown; // only compared, may be gone
+} J4statusFSInfoSlot;
+
+/// sections created and destroyed following the mount table
+typedef struct J4statusFSInfoDiscovery
+{
+    J4statusCoreInterface *core;
+    gchar **types; // NULL for any
+    gchar **exclude_types;
+    gchar **mountpoints; // globs, NULL for any
+    gchar **exclude_mountpoints;
+    guint64 min_size; // bytes
+    guint top; // number of fullest filesystems shown, 0 for all
+    J4statusFSInfoSection defaults; // format and settings of new sections
+    GHashTable *sections; // mount point -> J4statusFSInfoSection
+    GArray *slots; // of J4statusFSInfoSlot, in display order
+    guint serial; // of the mount index sections were synced with
+    guint refresh_id; // pending _j4status_fsinfo_discovery_refresh()
+} J4statusFSInfoDiscovery;
+
+/// a statvfs() call, run by the worker pool
+typedef struct J4statusFSInfoJob
+{
+    J4statusFSInfoSection *section; // NULL once the section is gone,
+                                    // under the jobs lock
+    J4statusPluginContext *context;
+    gchar *path;
+    struct statvfs stats;
+    gint error; // errno of statvfs(), 0 on success
+    guint timeout_id; // marks the section stale
+} J4statusFSInfoJob;
+
+/// detaching jobs from their section, which workers check
+/// Static as they may outlive the plugin context
+G_LOCK_DEFINE_STATIC(_j4status_fsinfo_jobs);
+
 /// possible mtab file location
 const gchar MTAB[] = "/etc/mtab";
 /// alternative mtab file location
 const gchar PROC_MOUNTS[] = "/proc/mounts";
+/// mount table with device numbers, which the kernel flags on changes
+const gchar PROC_MOUNTINFO[] = "/proc/self/mountinfo";
+/// block device stat files, by major:minor, partitions and dm devices too
+const gchar SYS_DEV_BLOCK_STAT[] = "/sys/dev/block/%u:%u/stat";
 //TODO: organize these things into an array if they keep growing
 
 /// indices for _j4status_fsinfo_tokens[]
@@ -79,10 +242,26 @@ enum J4statusFSInfoToken
     TOKEN_AVAILABLE_RATIO,
     TOKEN_FREE_RATIO,
     TOKEN_USED_RATIO,
+    TOKEN_RATE,
+    TOKEN_ETA_FULL,
+    TOKEN_MOUNTPOINT,
+    TOKEN_RESERVED,
+    TOKEN_INODES_USED,
+    TOKEN_INODES_AVAILABLE,
+    TOKEN_INODES_USED_RATIO,
+    TOKEN_IO_READ,
+    TOKEN_IO_WRITE,
+    TOKEN_IOPS,
+    TOKEN_IO_LATENCY,
+    TOKEN_IO_UTIL,
 
     TOTAL_TOKEN_COUNT
 };
 
+/// tokens that need block device stats sampled
+#define IO_TOKENS (1 << TOKEN_IO_READ | 1 << TOKEN_IO_WRITE | 1 << TOKEN_IOPS \
+                   | 1 << TOKEN_IO_LATENCY | 1 << TOKEN_IO_UTIL)
+
 /// used in j4status_format_string_parse()
 static const gchar *const _j4status_fsinfo_tokens[] =
 {
@@ -93,14 +272,315 @@ static const gchar *const _j4status_fsinfo_tokens[] =
     [TOKEN_AVAILABLE_RATIO] = "p_avail",
     [TOKEN_FREE_RATIO]      = "p_free", // ratio to "true" total
     [TOKEN_USED_RATIO]      = "p_used",
+    [TOKEN_RATE]            = "rate", // bytes per second, from the history
+    [TOKEN_ETA_FULL]        = "eta_full", // seconds
+    [TOKEN_MOUNTPOINT]      = "mountpoint",
+    [TOKEN_RESERVED]        = "reserved", // free - avail
+    [TOKEN_INODES_USED]     = "inodes_used",
+    [TOKEN_INODES_AVAILABLE] = "inodes_avail",
+    [TOKEN_INODES_USED_RATIO] = "p_inodes_used",
+    [TOKEN_IO_READ]         = "io_read", // bytes per second
+    [TOKEN_IO_WRITE]        = "io_write",
+    [TOKEN_IOPS]            = "iops",
+    [TOKEN_IO_LATENCY]      = "io_latency", // milliseconds
+    [TOKEN_IO_UTIL]         = "io_util", // percentage
 };
 
 
+/**
+ * Adds an entry to the mount index
+ * Strings must live until the next rebuild
+ */
+static void
+_j4status_fsinfo_mounts_add(J4statusPluginContext *context, gchar *device,
+                            gchar *path, gchar *type, gint64 devnum)
+{
+    J4statusFSInfoMount mount = { device, path, type, devnum };
+    g_array_append_val(context->mounts, mount);
+}
+
+/**
+ * Indexes the mount table, once it is read whole
+ * (so that the array does not move under the hash tables)
+ */
+static void
+_j4status_fsinfo_mounts_index(J4statusPluginContext *context)
+{
+    for (guint idx = 0; idx < context->mounts->len; idx++)
+      {
+        J4statusFSInfoMount *mount = &g_array_index(context->mounts,
+                                                    J4statusFSInfoMount, idx);
+        // like the mtab walk used to, the first mount of a device wins
+        if (!g_hash_table_contains(context->mounts_by_device, mount->device))
+            g_hash_table_insert(context->mounts_by_device, mount->device,
+                                mount);
+        if (mount->devnum != 0
+            && !g_hash_table_contains(context->mounts_by_devnum,
+                                      &mount->devnum))
+            g_hash_table_insert(context->mounts_by_devnum, &mount->devnum,
+                                mount);
+        // while a later mount on the same point hides earlier ones
+        g_hash_table_insert(context->mounts_by_path, mount->path, mount);
+      }
+}
+
+/**
+ * Unescapes a PROC_MOUNTINFO path in place
+ * Blanks and backslashes are escaped as octal, e.g. "\040"
+ */
+static gchar *
+_j4status_fsinfo_unescape(gchar *string)
+{
+    gchar *in = string;
+    gchar *out = string;
+    while (*in)
+      {
+        if (in[0] == '\\'
+            && in[1] >= '0' && in[1] <= '3'
+            && in[2] >= '0' && in[2] <= '7'
+            && in[3] >= '0' && in[3] <= '7')
+          {
+            *out++ = (in[1] - '0') << 6 | (in[2] - '0') << 3 | (in[3] - '0');
+            in += 4;
+          }
+        else
+            *out++ = *in++;
+      }
+    *out = '\0';
+    return string;
+}
+
+/**
+ * Parses a PROC_MOUNTINFO line into the mount index
+ * "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw"
+ * The line is split in place, the mount strings point into it
+ */
+static void
+_j4status_fsinfo_mounts_parse_line(J4statusPluginContext *context,
+                                   gchar *line)
+{
+    // mount ID, parent ID, major:minor, root, mount point
+    gchar *fields[5];
+    guint count = 0;
+    while (count < G_N_ELEMENTS(fields) && line)
+        fields[count++] = strsep(&line, " ");
+    // then options, and optional fields that end with a lone "-"
+    gchar *field;
+    while ((field = strsep(&line, " ")) != NULL && strcmp(field, "-") != 0)
+        ;
+    gchar *type = strsep(&line, " ");
+    gchar *device = strsep(&line, " ");
+    guint major, minor;
+    if (device && sscanf(fields[2], "%u:%u", &major, &minor) == 2)
+        _j4status_fsinfo_mounts_add(context,
+                                    _j4status_fsinfo_unescape(device),
+                                    _j4status_fsinfo_unescape(fields[4]),
+                                    type, makedev(major, minor));
+}
+
+/**
+ * Rebuilds the mount index
+ * From PROC_MOUNTINFO if it is open, which is only done when the kernel
+ * flags a change; from mtab otherwise, which is done once per tick
+ * for all sections
+ * Nothing is allocated per mount, the tables only grow to the largest
+ * mount table seen
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_fsinfo_mounts_rebuild(J4statusPluginContext *context)
+{
+    g_hash_table_remove_all(context->mounts_by_device);
+    g_hash_table_remove_all(context->mounts_by_path);
+    g_hash_table_remove_all(context->mounts_by_devnum);
+    g_array_set_size(context->mounts, 0);
+    g_string_chunk_clear(context->mount_strings);
+    context->mounts_serial++;
+
+    if (context->mountinfo_fd < 0)
+      {
+        FILE *mtab = setmntent(context->mtab, "r");
+        if (!mtab)
+            return FALSE;
+        struct mntent *mnt;
+        GStringChunk *strings = context->mount_strings;
+        while ((mnt = getmntent(mtab)) != NULL)
+            _j4status_fsinfo_mounts_add(context,
+                        g_string_chunk_insert(strings, mnt->mnt_fsname),
+                        g_string_chunk_insert(strings, mnt->mnt_dir),
+                        g_string_chunk_insert_const(strings, mnt->mnt_type),
+                        0);
+        endmntent(mtab);
+        _j4status_fsinfo_mounts_index(context);
+        return TRUE;
+      }
+
+    // a seq_file, which only gives its whole content to sequential reads
+    GString *buffer = context->mountinfo;
+    g_string_truncate(buffer, 0);
+    if (lseek(context->mountinfo_fd, 0, SEEK_SET) < 0)
+        return FALSE;
+    while (TRUE)
+      {
+        if (buffer->allocated_len - buffer->len < MOUNTINFO_SIZE / 4)
+          {
+            gsize length = buffer->len;
+            g_string_set_size(buffer, 2 * buffer->allocated_len);
+            g_string_set_size(buffer, length);
+          }
+        gssize size = read(context->mountinfo_fd, buffer->str + buffer->len,
+                           buffer->allocated_len - buffer->len - 1);
+        if (size < 0)
+            return FALSE;
+        if (size == 0)
+            break;
+        g_string_set_size(buffer, buffer->len + size);
+      }
+
+    gchar *line = buffer->str;
+    gchar *end;
+    while ((end = strchr(line, '\n')) != NULL)
+      {
+        *end = '\0';
+        _j4status_fsinfo_mounts_parse_line(context, line);
+        line = end + 1;
+      }
+    _j4status_fsinfo_mounts_index(context);
+    return TRUE;
+}
+
+/**
+ * Finds where a device is mounted
+ * By name, or by device number for names mtab does not use
+ * (e.g. /dev/disk/by-id links or /dev/mapper ones)
+ */
+static const J4statusFSInfoMount *
+_j4status_fsinfo_mounts_find(J4statusPluginContext *context,
+                             const gchar *device)
+{
+    const J4statusFSInfoMount *mount
+        = g_hash_table_lookup(context->mounts_by_device, device);
+    struct stat st;
+    if (!mount && stat(device, &st) >= 0 && S_ISBLK(st.st_mode))
+      {
+        gint64 devnum = st.st_rdev;
+        mount = g_hash_table_lookup(context->mounts_by_devnum, &devnum);
+      }
+    return mount;
+}
+
+static gboolean _j4status_fsinfo_update(gpointer user_data);
+
+/**
+ * GUnixFDSourceFunc instance
+ * Called when the mount table changes
+ */
+static gboolean
+_j4status_fsinfo_mounts_changed(G_GNUC_UNUSED gint fd,
+                                G_GNUC_UNUSED GIOCondition condition,
+                                gpointer user_data)
+{
+    J4statusPluginContext *context = user_data;
+    if (!_j4status_fsinfo_mounts_rebuild(context))
+      {
+        g_warning("Error reading %s: %s; reading %s on updates instead",
+                  PROC_MOUNTINFO, g_strerror(errno), context->mtab);
+        close(context->mountinfo_fd);
+        context->mountinfo_fd = -1;
+        context->watch_id = 0;
+        return G_SOURCE_REMOVE;
+      }
+    // sections may have been mounted or unmounted;
+    // and devices may be looked up by links udev only made after
+    // their kernel event, but before they got mounted
+    context->devices_serial++;
+    _j4status_fsinfo_update(context);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Checks whether a kernel uevent is about block devices coming, going,
+ * or changing (e.g. getting a new filesystem, and so UUID or label)
+ * "add@/devices/.../block/sdb/sdb1\0ACTION=add\0...\0SUBSYSTEM=block\0..."
+ */
+static gboolean
+_j4status_fsinfo_uevent_matches(const gchar *message, gsize size)
+{
+    const gchar *action = NULL;
+    gboolean block = FALSE;
+    for (const gchar *field = message; field < message + size;
+         field += strlen(field) + 1)
+      {
+        if (g_str_has_prefix(field, "ACTION="))
+            action = field + strlen("ACTION=");
+        else if (strcmp(field, "SUBSYSTEM=block") == 0)
+            block = TRUE;
+      }
+    return block && action
+           && (strcmp(action, "add") == 0 || strcmp(action, "remove") == 0
+               || strcmp(action, "change") == 0
+               || strcmp(action, "move") == 0);
+}
+
+/**
+ * GUnixFDSourceFunc instance
+ * Called on kernel uevents
+ * Devices are looked up again, once for all pending events
+ */
+static gboolean
+_j4status_fsinfo_uevent(gint fd, G_GNUC_UNUSED GIOCondition condition,
+                        gpointer user_data)
+{
+    J4statusPluginContext *context = user_data;
+    gchar buffer[UEVENT_SIZE];
+    gboolean changed = FALSE;
+    while (TRUE)
+      {
+        struct sockaddr_nl sender;
+        socklen_t length = sizeof(sender);
+        gssize size = recvfrom(fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT,
+                               (struct sockaddr *) &sender, &length);
+        if (size >= 0)
+          {
+            buffer[size] = '\0';
+            // only the kernel is trusted
+            if (sender.nl_pid == 0
+                && _j4status_fsinfo_uevent_matches(buffer, size))
+                changed = TRUE;
+            continue;
+          }
+        if (errno == EINTR)
+            continue;
+        // events were dropped, which may have been ours
+        if (errno == ENOBUFS)
+          {
+            changed = TRUE;
+            continue;
+          }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        g_warning("Error reading device events: %s; looking devices up "
+                  "on updates instead", g_strerror(errno));
+        close(context->uevent_fd);
+        context->uevent_fd = -1;
+        context->uevent_watch_id = 0;
+        return G_SOURCE_REMOVE;
+      }
+    if (changed)
+      {
+        context->devices_serial++;
+        // so that blkid does not keep answering with devices that are gone
+        if (context->cache)
+            blkid_gc_cache(context->cache);
+        _j4status_fsinfo_update(context);
+      }
+    return G_SOURCE_CONTINUE;
+}
 
 /**
  * Tries to find device by provided credentials
  * Returns successfulness of the attempt
- * Called only at section_update
+ * Called only at section_update, after device events
  */
 static gboolean
 _j4status_fsinfo_section_locate_device(J4statusFSInfoSection *section,
@@ -121,6 +601,7 @@ _j4status_fsinfo_section_locate_device(J4statusFSInfoSection *section,
                 section->device = g_strdup(section->id);
             break;
         case ID_MOUNTPOINT:
+            g_free(section->path);
             section->path = g_strdup(section->id);
             return TRUE;
         default:
@@ -130,6 +611,126 @@ _j4status_fsinfo_section_locate_device(J4statusFSInfoSection *section,
     return section->device != NULL;
 }
 
+/**
+ * Closes the block device stat file of a section
+ */
+static void
+_j4status_fsinfo_io_close(J4statusFSInfoIO *io)
+{
+    if (io->fd >= 0)
+        close(io->fd);
+    io->fd = -1;
+    io->devnum = 0;
+    io->time = 0;
+    io->valid = FALSE;
+}
+
+/**
+ * Opens the stat file of a block device, unless it is open already
+ * Returns FALSE if the device has none
+ */
+static gboolean
+_j4status_fsinfo_io_open(J4statusFSInfoIO *io, gint64 devnum)
+{
+    if (io->fd >= 0 && io->devnum == devnum)
+        return TRUE;
+    _j4status_fsinfo_io_close(io);
+    gchar *path = g_strdup_printf(SYS_DEV_BLOCK_STAT, major(devnum),
+                                  minor(devnum));
+    io->fd = open(path, O_RDONLY | O_CLOEXEC);
+    g_free(path);
+    if (io->fd < 0)
+        return FALSE;
+    io->devnum = devnum;
+    return TRUE;
+}
+
+/**
+ * Finds the block device under the mount point of a section
+ * Only done when the mount index changes
+ * The filesystem device number is tried first, then that of the
+ * mount source, for filesystems that have anonymous ones (e.g. btrfs),
+ * or when the mount table does not tell it
+ */
+static void
+_j4status_fsinfo_io_resolve(J4statusPluginContext *context,
+                            J4statusFSInfoSection *section)
+{
+    J4statusFSInfoIO *io = &section->io;
+    io->serial = context->mounts_serial;
+    const J4statusFSInfoMount *mount
+        = g_hash_table_lookup(context->mounts_by_path, section->path);
+    if (!mount)
+      {
+        _j4status_fsinfo_io_close(io);
+        return;
+      }
+    if (mount->devnum != 0 && _j4status_fsinfo_io_open(io, mount->devnum))
+        return;
+    struct stat st;
+    if (stat(mount->device, &st) >= 0 && S_ISBLK(st.st_mode)
+        && _j4status_fsinfo_io_open(io, st.st_rdev))
+        return;
+    _j4status_fsinfo_io_close(io);
+}
+
+/**
+ * Samples the block device stat file of a section
+ * and computes rates since the last sample
+ */
+static void
+_j4status_fsinfo_io_sample(J4statusFSInfoIO *io)
+{
+    gchar buffer[IO_STAT_SIZE];
+    gssize size = pread(io->fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0)
+      {
+        io->valid = FALSE;
+        return;
+      }
+    buffer[size] = '\0';
+    guint64 fields[IO_FIELD_COUNT];
+    gchar *line = buffer;
+    for (guint idx = 0; idx < IO_FIELD_COUNT; idx++)
+      {
+        gchar *end;
+        fields[idx] = g_ascii_strtoull(line, &end, 10);
+        if (end == line)
+          {
+            io->valid = FALSE;
+            return;
+          }
+        line = end;
+      }
+
+    gint64 time = g_get_monotonic_time();
+    io->valid = FALSE;
+    if (io->time != 0 && time > io->time)
+      {
+        guint64 delta[IO_FIELD_COUNT];
+        io->valid = TRUE;
+        for (guint idx = 0; idx < IO_FIELD_COUNT; idx++)
+          {
+            // counters are unsigned longs, which wrap on 32 bits systems
+            if (fields[idx] < io->fields[idx])
+                io->valid = FALSE;
+            delta[idx] = fields[idx] - io->fields[idx];
+          }
+        gdouble seconds = (time - io->time) / 1e6;
+        guint64 requests = delta[IO_READ_IOS] + delta[IO_WRITE_IOS];
+        io->read = delta[IO_READ_SECTORS] * IO_SECTOR_SIZE / seconds;
+        io->write = delta[IO_WRITE_SECTORS] * IO_SECTOR_SIZE / seconds;
+        io->iops = requests / seconds;
+        io->latency = requests > 0 ? (gdouble) (delta[IO_READ_TICKS]
+                                                + delta[IO_WRITE_TICKS])
+                                     / requests
+                                   : 0;
+        io->util = MIN(delta[IO_TICKS] / (seconds * 10), 100);
+      }
+    io->time = time;
+    memcpy(io->fields, fields, sizeof(fields));
+}
+
 /**
  * J4statusFormatStringReplaceCallback instance
  * Strings are in user_data[]
@@ -146,120 +747,504 @@ _j4status_fsinfo_format_callback(const gchar *token, guint64 value,
 }
 
 /**
- * A part of section_update that gets re-used several times
- * Reports an error during update and returns
+ * Empties a history, sums included
  */
-#define UPDATE_ERROR(error) do                                                \
-{                                                                             \
-    j4status_section_set_state(section->section, J4STATUS_STATE_BAD);         \
-    j4status_section_set_value(section->section, g_strdup("Error"));          \
-    g_warning(error);                                                         \
-    return;                                                                   \
-} while (0)
+static void
+_j4status_fsinfo_history_reset(J4statusFSInfoHistory *history)
+{
+    history->head = 0;
+    history->count = 0;
+    history->sum_t = history->sum_u = history->sum_tt = history->sum_tu = 0;
+}
 
 /**
- * GFunc instance
- * Called every "period" seconds
- * Locates the device if necessary
- * then calculates token values as needed
- * Unmounted/unplugged devices are also reported
- * (Referenced above as section_update)
+ * Allocates an empty history
  */
 static void
-_j4status_fsinfo_section_update(gpointer data, gpointer user_data)
+_j4status_fsinfo_history_init(J4statusFSInfoHistory *history, guint size)
 {
-    const gchar ESTATVFS[] = "Could not get filesystem stats";
+    history->samples = g_new(J4statusFSInfoSample, size);
+    history->size = size;
+    _j4status_fsinfo_history_reset(history);
+}
 
-    J4statusFSInfoSection *section = data;
-    J4statusPluginContext *context = user_data;
-    if ((!section->device || access(section->device, F_OK) < 0)
-       && !_j4status_fsinfo_section_locate_device(section, context->cache))
+/**
+ * Recomputes the sums of a history from its samples,
+ * relative to the oldest one
+ */
+static void
+_j4status_fsinfo_history_rebase(J4statusFSInfoHistory *history)
+{
+    guint oldest = (history->head + history->size - history->count)
+                   % history->size;
+    history->base = history->samples[oldest];
+    history->sum_t = history->sum_u = history->sum_tt = history->sum_tu = 0;
+    for (guint idx = 0; idx < history->count; idx++)
       {
-        j4status_section_set_state(section->section,
-                                   J4STATUS_STATE_UNAVAILABLE);
-        j4status_section_set_value(section->section,
-                                   g_strdup(context->not_found));
-        return;
+        const J4statusFSInfoSample *sample
+            = &history->samples[(oldest + idx) % history->size];
+        gdouble t = (sample->time - history->base.time) / 1e6;
+        gdouble u = (gdouble) sample->used - (gdouble) history->base.used;
+        history->sum_t += t;
+        history->sum_u += u;
+        history->sum_tt += t * t;
+        history->sum_tu += t * u;
       }
+}
 
-    struct statvfs stats;
-    if (section->path)
+/**
+ * Adds a sample to a history, dropping the oldest one if it is full
+ * The sums are updated in constant time
+ */
+static void
+_j4status_fsinfo_history_add(J4statusFSInfoHistory *history, guint64 used)
+{
+    J4statusFSInfoSample *sample = &history->samples[history->head];
+    if (history->count == history->size)
       {
-        if (statvfs(section->path, &stats) < 0)
-          {
-            //TODO: account for the possibility that device was unmounted
-            // & mount point deleted since last check
-            UPDATE_ERROR(ESTATVFS);
-          }
-        if (stats.f_fsid != section->fsid)
+        gdouble t = (sample->time - history->base.time) / 1e6;
+        gdouble u = (gdouble) sample->used - (gdouble) history->base.used;
+        history->sum_t -= t;
+        history->sum_u -= u;
+        history->sum_tt -= t * t;
+        history->sum_tu -= t * u;
+        history->count--;
+      }
+    sample->time = g_get_monotonic_time();
+    sample->used = used;
+    if (history->count == 0)
+        history->base = *sample;
+    gdouble t = (sample->time - history->base.time) / 1e6;
+    gdouble u = (gdouble) sample->used - (gdouble) history->base.used;
+    history->sum_t += t;
+    history->sum_u += u;
+    history->sum_tt += t * t;
+    history->sum_tu += t * u;
+    history->count++;
+    history->head = (history->head + 1) % history->size;
+    if (history->head == 0)
+        _j4status_fsinfo_history_rebase(history);
+}
+
+/**
+ * Gets the fill rate of a history, in bytes per second
+ * That is the slope of the least-squares line through its samples
+ * Returns FALSE if there is not enough history yet
+ */
+static gboolean
+_j4status_fsinfo_history_rate(const J4statusFSInfoHistory *history,
+                              gdouble *rate)
+{
+    gdouble n = history->count;
+    gdouble denominator = n * history->sum_tt
+                          - history->sum_t * history->sum_t;
+    if (history->count < 2 || denominator <= 0)
+        return FALSE;
+    *rate = (n * history->sum_tu - history->sum_t * history->sum_u)
+            / denominator;
+    return TRUE;
+}
+
+/**
+ * Worsens a state by how soon a filesystem runs out of something
+ * (blocks or inodes) at the rate it is used
+ * Read-only filesystems (e.g. iso9660, squashfs) have nothing available
+ * and are not full for all that
+ */
+static J4statusState
+_j4status_fsinfo_eta_state(const J4statusFSInfoSection *section,
+                           J4statusState state, guint64 avail, gdouble rate,
+                           gboolean read_only)
+{
+    if (avail == 0 && !read_only)
+        return J4STATUS_STATE_BAD;
+    if (rate <= 0)
+        return state;
+    gdouble eta = avail / rate;
+    if (eta < section->bad_eta)
+        return J4STATUS_STATE_BAD;
+    if (eta < section->average_eta && state != J4STATUS_STATE_BAD)
+        return J4STATUS_STATE_AVERAGE;
+    return state;
+}
+
+static void _j4status_fsinfo_section_free(gpointer data);
+
+/**
+ * GCompareDataFunc instance
+ * Orders discovered sections on display
+ * by mount table order, or fullest first in top mode
+ */
+static gint
+_j4status_fsinfo_discovered_compare(gconstpointer a, gconstpointer b,
+                                    gpointer user_data)
+{
+    const J4statusFSInfoDiscovery *discovery = user_data;
+    const J4statusFSInfoSection *first = *(J4statusFSInfoSection *const *) a;
+    const J4statusFSInfoSection *second = *(J4statusFSInfoSection *const *) b;
+    if (discovery->top > 0 && first->usage != second->usage)
+        return first->usage > second->usage ? -1 : 1;
+    return first->order < second->order ? -1 : first->order > second->order;
+}
+
+/**
+ * GSourceFunc instance
+ * Shows discovered sections through the slots
+ * Slots are only added or removed at the end, and only updated
+ * if what they show changed, so a steady set of filesystems costs nothing
+ * and a reordered one costs no section re-creation
+ * Scheduled by _j4status_fsinfo_discovery_schedule()
+ */
+static gboolean
+_j4status_fsinfo_discovery_refresh(gpointer user_data)
+{
+    J4statusFSInfoDiscovery *discovery = user_data;
+    discovery->refresh_id = 0;
+    GPtrArray *shown
+        = g_ptr_array_sized_new(g_hash_table_size(discovery->sections));
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, discovery->sections);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+      {
+        J4statusFSInfoSection *section = value;
+        // size is only known once updated successfully
+        if (section->usage >= 0 && section->size >= discovery->min_size)
+            g_ptr_array_add(shown, section);
+      }
+    g_ptr_array_sort_with_data(shown, &_j4status_fsinfo_discovered_compare,
+                               discovery);
+    guint count = shown->len;
+    if (discovery->top > 0)
+        count = MIN(count, discovery->top);
+
+    while (discovery->slots->len > count)
+      {
+        guint last = discovery->slots->len - 1;
+        j4status_section_free(g_array_index(discovery->slots,
+                                            J4statusFSInfoSlot,
+                                            last).section);
+        g_array_set_size(discovery->slots, last);
+      }
+    while (discovery->slots->len < count)
+      {
+        J4statusFSInfoSlot slot = { j4status_section_new(discovery->core),
+                                    NULL };
+        gchar *instance = g_strdup_printf("discovered-%u",
+                                          discovery->slots->len + 1);
+        j4status_section_set_name(slot.section, "fsinfo");
+        j4status_section_set_instance(slot.section, instance);
+        g_free(instance);
+        if (!j4status_section_insert(slot.section))
           {
-            if (section->id_t == ID_MOUNTPOINT)
-              {
-                section->fsid = stats.f_fsid;
-              }
-            else
-              {
-                g_free(section->path);
-                section->path = NULL;
-              }
+            j4status_section_free(slot.section);
+            break;
           }
+        g_array_append_val(discovery->slots, slot);
       }
-    if (!section->path)
+
+    for (guint idx = 0; idx < discovery->slots->len; idx++)
       {
-        FILE *mtab = setmntent(context->mtab, "r");
-        if (!mtab)
-            UPDATE_ERROR("Could not open mtab");
-        struct mntent *mnt;
-        while ((mnt = getmntent(mtab)) != NULL)
-            if (g_strcmp0(section->device, mnt->mnt_fsname) == 0)
-              {
-                section->path = g_strdup(mnt->mnt_dir);
-                break;
-              }
-        endmntent(mtab);
+        J4statusFSInfoSlot *slot = &g_array_index(discovery->slots,
+                                                  J4statusFSInfoSlot, idx);
+        J4statusFSInfoSection *section = shown->pdata[idx];
+        if (slot->shown == section && !section->dirty)
+            continue;
+        slot->shown = section;
+        section->dirty = FALSE;
+        j4status_section_set_state(slot->section, section->state);
+        j4status_section_set_value(slot->section, g_strdup(section->value));
+      }
+    g_ptr_array_free(shown, TRUE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedules one refresh of discovered sections for all updates
+ * that come in meanwhile
+ * At a low priority, so that it comes after statvfs() calls that are
+ * done already (see _j4status_fsinfo_job_done())
+ */
+static void
+_j4status_fsinfo_discovery_schedule(J4statusFSInfoDiscovery *discovery)
+{
+    if (!discovery->refresh_id)
+        discovery->refresh_id = g_idle_add_full(G_PRIORITY_LOW,
+                                        &_j4status_fsinfo_discovery_refresh,
+                                        discovery, NULL);
+}
+
+/**
+ * Sets the state and value of a section
+ * Directly, or through the slots for discovered ones
+ * Takes ownership of value
+ */
+static void
+_j4status_fsinfo_section_set(J4statusPluginContext *context,
+                             J4statusFSInfoSection *section,
+                             J4statusState state, gchar *value)
+{
+    if (!section->discovered)
+      {
+        j4status_section_set_state(section->section, state);
+        j4status_section_set_value(section->section, value);
+        return;
+      }
+    g_free(section->value);
+    section->value = value;
+    section->state = state;
+    section->dirty = TRUE;
+    _j4status_fsinfo_discovery_schedule(context->discovery);
+}
+
+/**
+ * Checks a mount against any of a list of globs
+ */
+static gboolean
+_j4status_fsinfo_glob_any(gchar **globs, const gchar *string)
+{
+    for (guint idx = 0; globs[idx]; idx++)
+      {
+        if (g_pattern_match_simple(globs[idx], string))
+            return TRUE;
+      }
+    return FALSE;
+}
+
+/**
+ * Checks a mount against discovery filters
+ * Size is left to _j4status_fsinfo_discovery_refresh(),
+ * once known
+ */
+static gboolean
+_j4status_fsinfo_discovery_match(const J4statusFSInfoDiscovery *discovery,
+                                 const J4statusFSInfoMount *mount)
+{
+    if (discovery->types
+        && !g_strv_contains((const gchar *const *) discovery->types,
+                            mount->type))
+        return FALSE;
+    if (discovery->exclude_types
+        && g_strv_contains((const gchar *const *) discovery->exclude_types,
+                           mount->type))
+        return FALSE;
+    if (discovery->mountpoints
+        && !_j4status_fsinfo_glob_any(discovery->mountpoints, mount->path))
+        return FALSE;
+    if (discovery->exclude_mountpoints
+        && _j4status_fsinfo_glob_any(discovery->exclude_mountpoints,
+                                     mount->path))
+        return FALSE;
+    return TRUE;
+}
+
+/**
+ * Creates a discovered section for a mount point
+ */
+static J4statusFSInfoSection *
+_j4status_fsinfo_discovered_new(const J4statusFSInfoDiscovery *discovery,
+                                const gchar *path)
+{
+    const J4statusFSInfoSection *defaults = &discovery->defaults;
+    J4statusFSInfoSection *section = g_new0(J4statusFSInfoSection, 1);
+    section->id_t = ID_MOUNTPOINT;
+    section->id = g_strdup(path);
+    section->format = j4status_format_string_ref(defaults->format);
+    section->used_tokens = defaults->used_tokens;
+    section->timeout = defaults->timeout;
+    _j4status_fsinfo_history_init(&section->history, defaults->history.size);
+    _j4status_fsinfo_history_init(&section->inode_history,
+                                  defaults->history.size);
+    section->average_eta = defaults->average_eta;
+    section->bad_eta = defaults->bad_eta;
+    section->io.fd = -1;
+    section->discovered = TRUE;
+    section->dirty = TRUE;
+    section->usage = -1;
+    return section;
+}
+
+/**
+ * GHRFunc instance
+ * Drops discovered sections whose mount point went away
+ */
+static gboolean
+_j4status_fsinfo_discovered_gone(G_GNUC_UNUSED gpointer key, gpointer value,
+                                 gpointer user_data)
+{
+    const J4statusFSInfoSection *section = value;
+    const J4statusFSInfoDiscovery *discovery = user_data;
+    return section->serial != discovery->serial;
+}
+
+/**
+ * Creates and destroys discovered sections following the mount index
+ * Only called when it was rebuilt
+ */
+static void
+_j4status_fsinfo_discovery_sync(J4statusPluginContext *context)
+{
+    J4statusFSInfoDiscovery *discovery = context->discovery;
+    discovery->serial = context->mounts_serial;
+    // filesystems that have a section configured are left to it
+    GHashTable *configured = g_hash_table_new(&g_str_hash, &g_str_equal);
+    for (GSList *node = context->sections; node; node = node->next)
+      {
+        const J4statusFSInfoSection *section = node->data;
         if (section->path)
+            g_hash_table_add(configured, section->path);
+      }
+    // so are filesystems mounted several times (e.g. bind mounts)
+    // past their first visible mount
+    GHashTable *devnums = g_hash_table_new(&g_int64_hash, &g_int64_equal);
+
+    for (guint idx = 0; idx < context->mounts->len; idx++)
+      {
+        J4statusFSInfoMount *mount = &g_array_index(context->mounts,
+                                                    J4statusFSInfoMount, idx);
+        if (g_hash_table_lookup(context->mounts_by_path, mount->path) != mount
+            || g_hash_table_contains(configured, mount->path)
+            || !_j4status_fsinfo_discovery_match(discovery, mount))
+            continue;
+        if (mount->devnum != 0)
+          {
+            if (g_hash_table_contains(devnums, &mount->devnum))
+                continue;
+            g_hash_table_add(devnums, &mount->devnum);
+          }
+
+        J4statusFSInfoSection *section
+            = g_hash_table_lookup(discovery->sections, mount->path);
+        if (!section)
           {
-            if (statvfs(section->path, &stats) < 0)
-                UPDATE_ERROR(ESTATVFS);
-            section->fsid = stats.f_fsid;
+            section = _j4status_fsinfo_discovered_new(discovery, mount->path);
+            g_hash_table_insert(discovery->sections, section->id, section);
           }
+        section->serial = discovery->serial;
+        section->order = idx;
       }
-    if (!section->path)
+    g_hash_table_foreach_remove(discovery->sections,
+                                &_j4status_fsinfo_discovered_gone, discovery);
+    g_hash_table_unref(devnums);
+    g_hash_table_unref(configured);
+
+    g_thread_pool_set_max_threads(context->pool,
+                                  g_slist_length(context->sections)
+                                  + g_hash_table_size(discovery->sections),
+                                  NULL);
+    _j4status_fsinfo_discovery_schedule(discovery);
+}
+
+/**
+ * A part of section_display that gets re-used several times
+ * Reports an error during update and returns
+ */
+#define UPDATE_ERROR(error) do                                                \
+{                                                                             \
+    _j4status_fsinfo_section_set(job->context, section, J4STATUS_STATE_BAD,   \
+                                 g_strdup("Error"));                          \
+    g_warning(error);                                                         \
+    return;                                                                   \
+} while (0)
+
+/**
+ * Calculates token values as needed from a finished statvfs() call
+ * (Referenced above as section_display)
+ */
+static void
+_j4status_fsinfo_section_display(J4statusFSInfoSection *section,
+                                 const J4statusFSInfoJob *job)
+{
+    if (job->error != 0)
       {
-        j4status_section_set_state(section->section, J4STATUS_STATE_NO_STATE);
-        j4status_section_set_value(section->section,
-                                   g_strdup(context->unmounted));
-        return;
+        //TODO: account for the possibility that device was unmounted
+        // & mount point deleted since last check
+        UPDATE_ERROR("Could not get filesystem stats");
       }
 
+    const struct statvfs *stats = &job->stats;
     GVariant *fdata[TOTAL_TOKEN_COUNT] = { NULL };
-    fsblkcnt_t used = stats.f_blocks - stats.f_bfree;
+    fsblkcnt_t used = stats->f_blocks - stats->f_bfree;
     // we don't include reserved blocks in total count
     // because (a) it wouldn't make sense to display static parameter
     // in dynamic statusline
     // and (b) all the other cool guys do it (like df)
     // although p_free does use real total in calculation,
     // since free includes privilegied blocks itself
-    fsblkcnt_t adjusted_total = used + stats.f_bavail;
+    fsblkcnt_t adjusted_total = used + stats->f_bavail;
     if (section->used_tokens & 1 << TOKEN_AVAILABLE)
-        fdata[TOKEN_AVAILABLE] = g_variant_new_uint64(stats.f_bavail * stats.f_bsize);
+        fdata[TOKEN_AVAILABLE] = g_variant_new_uint64(stats->f_bavail * stats->f_bsize);
     if (section->used_tokens & 1 << TOKEN_FREE)
-        fdata[TOKEN_FREE] = g_variant_new_uint64(stats.f_bfree * stats.f_bsize);
+        fdata[TOKEN_FREE] = g_variant_new_uint64(stats->f_bfree * stats->f_bsize);
     if (section->used_tokens & 1 << TOKEN_USED)
-        fdata[TOKEN_USED] = g_variant_new_uint64(used * stats.f_bsize);
+        fdata[TOKEN_USED] = g_variant_new_uint64(used * stats->f_bsize);
     if (section->used_tokens & 1 << TOKEN_TOTAL)
-        fdata[TOKEN_TOTAL] = g_variant_new_uint64(adjusted_total * stats.f_bsize);
+        fdata[TOKEN_TOTAL] = g_variant_new_uint64(adjusted_total * stats->f_bsize);
     if (section->used_tokens & 1 << TOKEN_AVAILABLE_RATIO)
-        fdata[TOKEN_AVAILABLE_RATIO] = g_variant_new_double(100.0 * stats.f_bavail / adjusted_total);
+        fdata[TOKEN_AVAILABLE_RATIO] = g_variant_new_double(100.0 * stats->f_bavail / adjusted_total);
     if (section->used_tokens & 1 << TOKEN_FREE_RATIO)
-        fdata[TOKEN_FREE_RATIO] = g_variant_new_double(100.0 * stats.f_bfree / stats.f_blocks);
+        fdata[TOKEN_FREE_RATIO] = g_variant_new_double(100.0 * stats->f_bfree / stats->f_blocks);
     if (section->used_tokens & 1 << TOKEN_USED_RATIO)
         fdata[TOKEN_USED_RATIO] = g_variant_new_double(100.0 * used / adjusted_total);
+    if (section->used_tokens & 1 << TOKEN_MOUNTPOINT)
+        fdata[TOKEN_MOUNTPOINT] = g_variant_new_string(job->path);
+    if (section->used_tokens & 1 << TOKEN_RESERVED)
+        fdata[TOKEN_RESERVED] = g_variant_new_uint64((stats->f_bfree - stats->f_bavail) * stats->f_bsize);
+    if (section->io.valid)
+      {
+        if (section->used_tokens & 1 << TOKEN_IO_READ)
+            fdata[TOKEN_IO_READ] = g_variant_new_double(section->io.read);
+        if (section->used_tokens & 1 << TOKEN_IO_WRITE)
+            fdata[TOKEN_IO_WRITE] = g_variant_new_double(section->io.write);
+        if (section->used_tokens & 1 << TOKEN_IOPS)
+            fdata[TOKEN_IOPS] = g_variant_new_double(section->io.iops);
+        if (section->used_tokens & 1 << TOKEN_IO_LATENCY)
+            fdata[TOKEN_IO_LATENCY] = g_variant_new_double(section->io.latency);
+        if (section->used_tokens & 1 << TOKEN_IO_UTIL)
+            fdata[TOKEN_IO_UTIL] = g_variant_new_double(section->io.util);
+      }
+    section->size = adjusted_total * stats->f_bsize;
+    section->usage = adjusted_total > 0 ? (gdouble) used / adjusted_total : 0;
 
-    //TODO: configurable coeff?
-    j4status_section_set_state(section->section, used < adjusted_total * 3/4 ?
-                                 J4STATUS_STATE_GOOD : J4STATUS_STATE_AVERAGE);
-    j4status_section_set_value(section->section,
+    // the state goes by how soon the filesystem will be full at this rate,
+    // a big but still one is fine, a small but quickly filling one is not
+    _j4status_fsinfo_history_add(&section->history, used * stats->f_bsize);
+    gdouble rate;
+    if (_j4status_fsinfo_history_rate(&section->history, &rate))
+      {
+        if (section->used_tokens & 1 << TOKEN_RATE)
+            fdata[TOKEN_RATE] = g_variant_new_double(rate);
+        if (rate > 0 && section->used_tokens & 1 << TOKEN_ETA_FULL)
+            fdata[TOKEN_ETA_FULL] = g_variant_new_uint64(MIN(stats->f_bavail * stats->f_bsize / rate, 1e18));
+      }
+    else
+        rate = 0;
+    gboolean read_only = (stats->f_flag & ST_RDONLY) != 0;
+    J4statusState state = _j4status_fsinfo_eta_state(section,
+                                                     J4STATUS_STATE_GOOD,
+                                                     stats->f_bavail * stats->f_bsize,
+                                                     rate, read_only);
+
+    // and by how soon it will run out of inodes, the worst of both wins
+    // (some filesystems, e.g. btrfs, allocate them dynamically and have none)
+    if (stats->f_files > 0)
+      {
+        fsfilcnt_t inodes_used = stats->f_files - stats->f_ffree;
+        // some virtual filesystems report inodes, but none used or available
+        fsfilcnt_t inodes_total = inodes_used + stats->f_favail;
+        if (section->used_tokens & 1 << TOKEN_INODES_USED)
+            fdata[TOKEN_INODES_USED] = g_variant_new_uint64(inodes_used);
+        if (section->used_tokens & 1 << TOKEN_INODES_AVAILABLE)
+            fdata[TOKEN_INODES_AVAILABLE] = g_variant_new_uint64(stats->f_favail);
+        if (section->used_tokens & 1 << TOKEN_INODES_USED_RATIO)
+            fdata[TOKEN_INODES_USED_RATIO] = g_variant_new_double(inodes_total > 0 ? 100.0 * inodes_used / inodes_total : 0);
+        _j4status_fsinfo_history_add(&section->inode_history, inodes_used);
+        if (!_j4status_fsinfo_history_rate(&section->inode_history, &rate))
+            rate = 0;
+        state = _j4status_fsinfo_eta_state(section, state, stats->f_favail,
+                                           rate, read_only);
+      }
+    _j4status_fsinfo_section_set(job->context, section, state,
                                j4status_format_string_replace(section->format,
                                    &_j4status_fsinfo_format_callback, &fdata));
     for (guint idx = 0; idx < TOTAL_TOKEN_COUNT; idx++)
@@ -269,6 +1254,178 @@ _j4status_fsinfo_section_update(gpointer data, gpointer user_data)
       }
 }
 
+/**
+ * Frees a job, once done or detached from its section
+ */
+static void
+_j4status_fsinfo_job_free(J4statusFSInfoJob *job)
+{
+    g_free(job->path);
+    g_free(job);
+}
+
+/**
+ * GSourceFunc instance
+ * Called in the main loop once a statvfs() call is done
+ */
+static gboolean
+_j4status_fsinfo_job_done(gpointer user_data)
+{
+    J4statusFSInfoJob *job = user_data;
+    G_LOCK(_j4status_fsinfo_jobs);
+    J4statusFSInfoSection *section = job->section;
+    G_UNLOCK(_j4status_fsinfo_jobs);
+    // a detached job must not touch the context, which may be gone
+    if (section)
+      {
+        section->job = NULL;
+        if (job->timeout_id)
+            g_source_remove(job->timeout_id);
+        _j4status_fsinfo_section_display(section, job);
+      }
+    _j4status_fsinfo_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * GFunc instance
+ * Called in a worker thread, which may block for long on network filesystems
+ * Only touches the job path and results,
+ * the section is left to the main loop
+ * Detached jobs (the plugin is going away) are freed right here,
+ * without calling statvfs() if they were still queued
+ */
+static void
+_j4status_fsinfo_job_run(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusFSInfoJob *job = data;
+    G_LOCK(_j4status_fsinfo_jobs);
+    gboolean detached = job->section == NULL;
+    G_UNLOCK(_j4status_fsinfo_jobs);
+    if (detached)
+      {
+        _j4status_fsinfo_job_free(job);
+        return;
+      }
+
+    job->error = statvfs(job->path, &job->stats) < 0 ? errno : 0;
+
+    G_LOCK(_j4status_fsinfo_jobs);
+    detached = job->section == NULL;
+    if (!detached)
+        g_idle_add(&_j4status_fsinfo_job_done, job);
+    G_UNLOCK(_j4status_fsinfo_jobs);
+    if (detached)
+        _j4status_fsinfo_job_free(job);
+}
+
+/**
+ * GSourceFunc instance
+ * Called when a statvfs() call takes longer than the section timeout
+ * The call is left to finish, no other one is queued behind it meanwhile
+ */
+static gboolean
+_j4status_fsinfo_job_timeout(gpointer user_data)
+{
+    J4statusFSInfoJob *job = user_data;
+    job->timeout_id = 0;
+    _j4status_fsinfo_section_set(job->context, job->section,
+                                 J4STATUS_STATE_UNAVAILABLE,
+                                 g_strdup(job->context->stale));
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * GFunc instance
+ * Called every "period" seconds
+ * Locates the device if necessary
+ * then has a worker call statvfs() on its mount point
+ * Unmounted/unplugged devices are also reported
+ * (Referenced above as section_update)
+ */
+static void
+_j4status_fsinfo_section_update(gpointer data, gpointer user_data)
+{
+    J4statusFSInfoSection *section = data;
+    J4statusPluginContext *context = user_data;
+    // whether the device is there only changes along with device events,
+    // so unplugged devices cost nothing until they come back;
+    // without them, only missing devices are looked up, on each tick
+    gboolean lookup = context->uevent_fd >= 0
+        ? section->devices_serial != context->devices_serial
+        : !section->found
+          || (section->device && access(section->device, F_OK) < 0);
+    if (lookup)
+      {
+        section->devices_serial = context->devices_serial;
+        section->found = _j4status_fsinfo_section_locate_device(section,
+                                                              context->cache);
+      }
+    if (!section->found)
+      {
+        _j4status_fsinfo_section_set(context, section,
+                                     J4STATUS_STATE_UNAVAILABLE,
+                                     g_strdup(context->not_found));
+        return;
+      }
+    // still waiting on the last call, maybe stale already
+    if (section->job)
+        return;
+
+    // the mount index is up to date, so lookups are all it takes
+    // to follow the device being remounted elsewhere
+    if (section->id_t != ID_MOUNTPOINT)
+      {
+        const J4statusFSInfoMount *mount
+            = _j4status_fsinfo_mounts_find(context, section->device);
+        // another filesystem has another history
+        if (!mount || g_strcmp0(mount->path, section->path) != 0)
+          {
+            _j4status_fsinfo_history_reset(&section->history);
+            _j4status_fsinfo_history_reset(&section->inode_history);
+            g_free(section->path);
+            section->path = mount ? g_strdup(mount->path) : NULL;
+          }
+      }
+    if (!section->path)
+      {
+        _j4status_fsinfo_section_set(context, section,
+                                     J4STATUS_STATE_NO_STATE,
+                                     g_strdup(context->unmounted));
+        return;
+      }
+
+    // the stat file only changes along with the mount table
+    if (section->used_tokens & IO_TOKENS)
+      {
+        if (section->io.serial != context->mounts_serial)
+            _j4status_fsinfo_io_resolve(context, section);
+        if (section->io.fd >= 0)
+            _j4status_fsinfo_io_sample(&section->io);
+      }
+
+    J4statusFSInfoJob *job = g_new0(J4statusFSInfoJob, 1);
+    job->section = section;
+    job->context = context;
+    job->path = g_strdup(section->path);
+    job->timeout_id = g_timeout_add_seconds(section->timeout,
+                                            &_j4status_fsinfo_job_timeout,
+                                            job);
+    section->job = job;
+    g_thread_pool_push(context->pool, job, NULL);
+}
+
+/**
+ * GHFunc instance
+ * Calls section_update on a discovered section
+ */
+static void
+_j4status_fsinfo_discovered_update(G_GNUC_UNUSED gpointer key, gpointer value,
+                                   gpointer user_data)
+{
+    _j4status_fsinfo_section_update(value, user_data);
+}
+
 /**
  * GSourceFunc instance
  * Called on plugin start
@@ -279,8 +1436,17 @@ _j4status_fsinfo_update(gpointer user_data)
 {
     J4statusPluginContext *context = user_data;
     if (!context->started) return G_SOURCE_REMOVE;
+    if (context->mountinfo_fd < 0 && !_j4status_fsinfo_mounts_rebuild(context))
+        g_warning("Could not open mtab");
     g_slist_foreach(context->sections, &_j4status_fsinfo_section_update,
                     context);
+    if (context->discovery)
+      {
+        if (context->discovery->serial != context->mounts_serial)
+            _j4status_fsinfo_discovery_sync(context);
+        g_hash_table_foreach(context->discovery->sections,
+                             &_j4status_fsinfo_discovered_update, context);
+      }
     return G_SOURCE_CONTINUE;
 }
 
@@ -293,8 +1459,23 @@ static void
 _j4status_fsinfo_section_free(gpointer data)
 {
     J4statusFSInfoSection *section = data;
-    j4status_section_free(section->section);
+    // a hung call outlives its section, which it must not touch then
+    if (section->job)
+      {
+        if (section->job->timeout_id)
+            g_source_remove(section->job->timeout_id);
+        section->job->timeout_id = 0;
+        G_LOCK(_j4status_fsinfo_jobs);
+        section->job->section = NULL;
+        G_UNLOCK(_j4status_fsinfo_jobs);
+      }
+    if (section->section)
+        j4status_section_free(section->section);
     j4status_format_string_unref(section->format);
+    g_free(section->value);
+    g_free(section->history.samples);
+    g_free(section->inode_history.samples);
+    _j4status_fsinfo_io_close(&section->io);
     g_free(section->id);
     g_free(section->device);
     g_free(section->path);
@@ -313,6 +1494,16 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
 {
     const gchar FILESYSTEM[] = "Filesystem";
     const gchar FORMAT_DEFAULT[] = "${avail(b.1)}b (${p_avail(f04.1)}%)";
+    const gchar DISCOVER_FORMAT_DEFAULT[]
+        = "${mountpoint} ${avail(b.1)}b (${p_avail(f04.1)}%)";
+    // nothing to show, or (autofs) mounting on access
+    const gchar *const DISCOVER_EXCLUDE_TYPES_DEFAULT[] =
+      {
+        "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs",
+        "debugfs", "devpts", "devtmpfs", "efivarfs", "fusectl", "hugetlbfs",
+        "mqueue", "nsfs", "proc", "pstore", "rpc_pipefs", "securityfs",
+        "squashfs", "sysfs", "tmpfs", "tracefs", NULL
+      };
 
     GKeyFile *key_file = j4status_config_get_key_file(FILESYSTEM);
     if (!key_file) return NULL;
@@ -328,7 +1519,9 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
       }
     gchar **names = g_key_file_get_string_list(key_file, FILESYSTEM, "Names",
                                                NULL, NULL);
-    if (!names)
+    gboolean discover = g_key_file_get_boolean(key_file, FILESYSTEM,
+                                               "Discover", NULL);
+    if (!names && !discover)
       {
         g_key_file_free(key_file);
         return NULL;
@@ -339,13 +1532,23 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
                                                     "NotFound", NULL, NULL);
     gchar *unmounted = g_key_file_get_locale_string(key_file, FILESYSTEM,
                                                     "Unmounted", NULL, NULL);
+    gchar *stale = g_key_file_get_locale_string(key_file, FILESYSTEM,
+                                                "Stale", NULL, NULL);
+    gint timeout = g_key_file_get_integer(key_file, FILESYSTEM, // positive only
+                                          "Timeout", NULL);
+    gint history_size = g_key_file_get_integer(key_file, FILESYSTEM,
+                                               "HistorySize", NULL);
+    gint average_eta = g_key_file_get_integer(key_file, FILESYSTEM,
+                                              "AverageTimeToFull", NULL);
+    gint bad_eta = g_key_file_get_integer(key_file, FILESYSTEM,
+                                          "BadTimeToFull", NULL);
     blkid_cache cache;
     gboolean blkid = blkid_get_cache(&cache, NULL) >= 0;
     if (!blkid)
         g_warning("Could not open blkid cache; UUID/label resolving disabled");
 
     GSList *sections = NULL;
-    for (guint idx = 0; names[idx]; idx++)
+    for (guint idx = 0; names && names[idx]; idx++)
       {
         gchar *group = g_strjoin(" ", FILESYSTEM, names[idx], NULL);
         if (!g_key_file_has_group(key_file, group))
@@ -354,7 +1557,7 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
             continue;
           }
 
-        J4statusFSInfoSection *section = g_new(J4statusFSInfoSection, 1);
+        J4statusFSInfoSection *section = g_new0(J4statusFSInfoSection, 1);
         if (blkid)
           {
             section->id = g_key_file_get_string(key_file, group, "UUID", NULL);
@@ -394,10 +1597,24 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
 
         gchar *format = g_key_file_get_locale_string(key_file, group,
                                                      "Format", NULL, NULL);
+        gint section_timeout = g_key_file_get_integer(key_file, group,
+                                                      "Timeout", NULL);
         g_free(group);
 
         section->device = NULL;
         section->path = NULL;
+        section->timeout = section_timeout > 0 ? section_timeout
+                         : timeout > 0 ? timeout : 5;
+        section->job = NULL;
+        section->io.fd = -1;
+        // ten minutes at the default frequency, enough to smooth out
+        // temporary files while still following trends quickly
+        _j4status_fsinfo_history_init(&section->history,
+                                      history_size > 1 ? history_size : 60);
+        _j4status_fsinfo_history_init(&section->inode_history,
+                                      section->history.size);
+        section->average_eta = average_eta > 0 ? average_eta : 24 * 3600;
+        section->bad_eta = bad_eta > 0 ? bad_eta : 3600;
         section->format = j4status_format_string_parse(format,
                                     _j4status_fsinfo_tokens, TOTAL_TOKEN_COUNT,
                                         FORMAT_DEFAULT, &section->used_tokens);
@@ -411,7 +1628,60 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
             sections = g_slist_prepend(sections, section);
       }
     g_strfreev(names);
-    if (!sections) return NULL;
+
+    J4statusFSInfoDiscovery *discovery = NULL;
+    if (discover)
+      {
+        discovery = g_new0(J4statusFSInfoDiscovery, 1);
+        discovery->core = core;
+        discovery->types = g_key_file_get_string_list(key_file, FILESYSTEM,
+                                                      "DiscoverTypes",
+                                                      NULL, NULL);
+        discovery->exclude_types = g_key_file_get_string_list(key_file,
+                                                FILESYSTEM,
+                                                "DiscoverExcludeTypes",
+                                                NULL, NULL);
+        if (!discovery->exclude_types)
+            discovery->exclude_types
+                = g_strdupv((gchar **) DISCOVER_EXCLUDE_TYPES_DEFAULT);
+        discovery->mountpoints = g_key_file_get_string_list(key_file,
+                                                FILESYSTEM,
+                                                "DiscoverMountpoints",
+                                                NULL, NULL);
+        discovery->exclude_mountpoints = g_key_file_get_string_list(key_file,
+                                                FILESYSTEM,
+                                                "DiscoverExcludeMountpoints",
+                                                NULL, NULL);
+        // an empty list of what to include means no filter
+        if (discovery->types && !discovery->types[0])
+            g_clear_pointer(&discovery->types, g_strfreev);
+        if (discovery->mountpoints && !discovery->mountpoints[0])
+            g_clear_pointer(&discovery->mountpoints, g_strfreev);
+        guint64 min_size = g_key_file_get_uint64(key_file, FILESYSTEM,
+                                                 "DiscoverMinSize", NULL);
+        // filesystems with no size at all are pseudo ones
+        discovery->min_size = min_size > 0 ? min_size : 1;
+        gint top = g_key_file_get_integer(key_file, FILESYSTEM,
+                                          "DiscoverTop", NULL);
+        discovery->top = top > 0 ? top : 0;
+
+        gchar *format = g_key_file_get_locale_string(key_file, FILESYSTEM,
+                                                     "DiscoverFormat",
+                                                     NULL, NULL);
+        J4statusFSInfoSection *defaults = &discovery->defaults;
+        defaults->format = j4status_format_string_parse(format,
+                                    _j4status_fsinfo_tokens, TOTAL_TOKEN_COUNT,
+                               DISCOVER_FORMAT_DEFAULT, &defaults->used_tokens);
+        defaults->timeout = timeout > 0 ? timeout : 5;
+        defaults->history.size = history_size > 1 ? history_size : 60;
+        defaults->average_eta = average_eta > 0 ? average_eta : 24 * 3600;
+        defaults->bad_eta = bad_eta > 0 ? bad_eta : 3600;
+        discovery->sections = g_hash_table_new_full(&g_str_hash, &g_str_equal,
+                                        NULL, &_j4status_fsinfo_section_free);
+        discovery->slots = g_array_new(FALSE, FALSE,
+                                       sizeof(J4statusFSInfoSlot));
+      }
+    if (!sections && !discovery) return NULL;
 
     J4statusPluginContext *context = g_new(J4statusPluginContext, 1);
     context->sections = sections;
@@ -419,8 +1689,29 @@ _j4status_fsinfo_init(J4statusCoreInterface *core)
     context->period = period > 0 ? period : 10;
     context->not_found = not_found ? not_found : g_strdup("Not found");
     context->unmounted = unmounted ? unmounted : g_strdup("Unmounted");
+    context->stale = stale ? stale : g_strdup("Stale");
+    // so that a hung filesystem never holds the others back
+    // (discovery adjusts the size as sections come and go)
+    context->pool = g_thread_pool_new(&_j4status_fsinfo_job_run, context,
+                                      MAX(g_slist_length(sections), 1),
+                                      FALSE, NULL);
     context->cache = blkid ? cache : NULL;
     context->mtab = mtab;
+    context->mounts = g_array_new(FALSE, FALSE, sizeof(J4statusFSInfoMount));
+    context->mount_strings = g_string_chunk_new(MOUNTINFO_SIZE);
+    // keys belong to the mounts
+    context->mounts_by_device = g_hash_table_new(&g_str_hash, &g_str_equal);
+    context->mounts_by_path = g_hash_table_new(&g_str_hash, &g_str_equal);
+    context->mounts_by_devnum = g_hash_table_new(&g_int64_hash,
+                                                 &g_int64_equal);
+    context->mountinfo_fd = -1;
+    context->watch_id = 0;
+    context->mountinfo = g_string_sized_new(MOUNTINFO_SIZE);
+    context->mounts_serial = 0;
+    context->uevent_fd = -1;
+    context->uevent_watch_id = 0;
+    context->devices_serial = 1; // so that sections look devices up first
+    context->discovery = discovery;
     return context;
   }
 
@@ -433,6 +1724,45 @@ _j4status_fsinfo_start(J4statusPluginContext *context)
 {
     if (context->started) return;
     context->started = TRUE;
+    context->mountinfo_fd = open(PROC_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+    if (context->mountinfo_fd >= 0
+        && !_j4status_fsinfo_mounts_rebuild(context))
+      {
+        close(context->mountinfo_fd);
+        context->mountinfo_fd = -1;
+      }
+    if (context->mountinfo_fd >= 0)
+        context->watch_id = g_unix_fd_add(context->mountinfo_fd,
+                                          G_IO_PRI | G_IO_ERR,
+                                          &_j4status_fsinfo_mounts_changed,
+                                          context);
+    else
+        g_message("Could not read %s; reading %s on updates instead",
+                  PROC_MOUNTINFO, context->mtab);
+
+    context->uevent_fd = socket(AF_NETLINK,
+                                SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                NETLINK_KOBJECT_UEVENT);
+    struct sockaddr_nl address = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = UEVENT_GROUP_KERNEL,
+    };
+    if (context->uevent_fd >= 0
+        && bind(context->uevent_fd, (struct sockaddr *) &address,
+                sizeof(address)) < 0)
+      {
+        close(context->uevent_fd);
+        context->uevent_fd = -1;
+      }
+    if (context->uevent_fd >= 0)
+        context->uevent_watch_id = g_unix_fd_add(context->uevent_fd, G_IO_IN,
+                                                 &_j4status_fsinfo_uevent,
+                                                 context);
+    else
+        g_message("Could not listen to device events; "
+                  "looking devices up on updates instead");
+    // devices may have come or gone while stopped
+    context->devices_serial++;
     _j4status_fsinfo_update(context);
     g_timeout_add_seconds(context->period, &_j4status_fsinfo_update, context);
 }
@@ -445,6 +1775,18 @@ static void
 _j4status_fsinfo_stop(J4statusPluginContext *context)
 {
     context->started = FALSE;
+    if (context->watch_id)
+        g_source_remove(context->watch_id);
+    context->watch_id = 0;
+    if (context->mountinfo_fd >= 0)
+        close(context->mountinfo_fd);
+    context->mountinfo_fd = -1;
+    if (context->uevent_watch_id)
+        g_source_remove(context->uevent_watch_id);
+    context->uevent_watch_id = 0;
+    if (context->uevent_fd >= 0)
+        close(context->uevent_fd);
+    context->uevent_fd = -1;
 }
 
 /**
@@ -455,9 +1797,39 @@ static void
 _j4status_fsinfo_uninit(J4statusPluginContext *context)
 {
     if (context->started) _j4status_fsinfo_stop(context);
+    // freeing sections detaches their jobs first
     g_slist_free_full(context->sections, &_j4status_fsinfo_section_free);
-    //TODO: drop cache dynamically
+    if (context->discovery)
+      {
+        J4statusFSInfoDiscovery *discovery = context->discovery;
+        if (discovery->refresh_id)
+            g_source_remove(discovery->refresh_id);
+        for (guint idx = 0; idx < discovery->slots->len; idx++)
+            j4status_section_free(g_array_index(discovery->slots,
+                                                J4statusFSInfoSlot,
+                                                idx).section);
+        g_array_unref(discovery->slots);
+        g_hash_table_unref(discovery->sections);
+        j4status_format_string_unref(discovery->defaults.format);
+        g_strfreev(discovery->exclude_mountpoints);
+        g_strfreev(discovery->mountpoints);
+        g_strfreev(discovery->exclude_types);
+        g_strfreev(discovery->types);
+        g_free(discovery);
+      }
+    // so that workers free queued jobs instead of them being dropped
+    // (leaked), and running ones when they return, hung ones included;
+    // none of them touches the context
+    g_thread_pool_free(context->pool, FALSE, FALSE);
+    // (garbage collected on device events meanwhile)
     blkid_put_cache(context->cache);
+    g_hash_table_unref(context->mounts_by_devnum);
+    g_hash_table_unref(context->mounts_by_path);
+    g_hash_table_unref(context->mounts_by_device);
+    g_array_unref(context->mounts);
+    g_string_chunk_free(context->mount_strings);
+    g_string_free(context->mountinfo, TRUE);
+    g_free(context->stale);
     g_free(context->unmounted);
     g_free(context->not_found);
     g_free(context);
@@ -1,8 +1,8 @@
 AC_DEFUN([J4STATUS_PLUGINS_PLUGIN_FSINFO], [
     J4SP_ADD_INPUT_PLUGIN(fsinfo, [Disk usage], [yes], [
         PKG_CHECK_MODULES([FSINFO_PLUGIN], [glib-2.0 blkid])
-        AC_CHECK_HEADERS([unistd.h mntent.h sys/statvfs.h], [], [
-            AC_MSG_ERROR([unistd.h, mntent.h, and sys/statvfs.h are required for the fsinfo plugin])
+        AC_CHECK_HEADERS([errno.h fcntl.h stdio.h string.h unistd.h mntent.h sys/socket.h sys/stat.h sys/statvfs.h sys/sysmacros.h linux/netlink.h], [], [
+            AC_MSG_ERROR([errno.h, fcntl.h, stdio.h, string.h, unistd.h, mntent.h, sys/socket.h, sys/stat.h, sys/statvfs.h, sys/sysmacros.h, and linux/netlink.h are required for the fsinfo plugin])
         ])
     ])
 ])
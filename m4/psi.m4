@@ -0,0 +1,8 @@
+AC_DEFUN([J4STATUS_PLUGINS_PLUGIN_PSI], [
+    J4SP_ADD_INPUT_PLUGIN(psi, [Pressure stall information], [yes], [
+        PKG_CHECK_MODULES([PSI_PLUGIN], [glib-2.0])
+        AC_CHECK_HEADERS([errno.h fcntl.h string.h unistd.h], [], [
+            AC_MSG_ERROR([errno.h, fcntl.h, string.h, and unistd.h are required for the psi plugin])
+        ])
+    ])
+])
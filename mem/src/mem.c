@@ -2,85 +2,1649 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 
-#ifdef HAVE_ERRNO_H
 #include <errno.h>
-#endif /* HAVE_ERRNO_H */
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
-#include <sys/sysinfo.h>
+#include <glib-unix.h>
 
 #include <j4status-plugin-input.h>
 
 #define TIME_SIZE 4095
 
+/* Initial size of the buffers files are read into,
+ * they grow if needed on the first reads */
+#define MEMINFO_SIZE 4096
+#define VMSTAT_SIZE 8192
+#define NODE_MEMINFO_SIZE 2048
+#define EVENTS_SIZE 256
+
+/* Size of the buffer /proc entries are read into by getdents64(),
+ * enough for a thousand processes per call */
+#define DENTS_SIZE 32768
+
+/* Size of the buffer process files are read into,
+ * Pss is the third line of smaps_rollup */
+#define PID_FILE_SIZE 256
+
+/* Length of a process name, including the nul byte (TASK_COMM_LEN) */
+#define COMM_SIZE 16
+
+/* smaps_rollup reads per tick, past the first one,
+ * so that a lot of big processes do not make ticks slow */
+#define PSS_READS_PER_TICK 32
+
+/* statm reads per tick of known processes, past the top ones,
+ * new processes are read on sight */
+#define STATM_READS_PER_TICK 256
+
+/* Size of the buffer zram and zswap files are read into,
+ * mm_stat is a single line of nine numbers */
+#define ZRAM_FILE_SIZE 256
+
+/* /proc/meminfo lines we may look at, in file order */
+enum J4statusMemEntry {
+    MEM_TOTAL,
+    MEM_FREE,
+    MEM_AVAILABLE,
+    MEM_BUFFERS,
+    MEM_CACHED,
+    MEM_SWAP_TOTAL,
+    MEM_SWAP_FREE,
+    MEM_ZSWAP, /* the compressed pool, since Linux 5.19 */
+    MEM_ZSWAPPED, /* what is in it, uncompressed */
+    MEM_DIRTY,
+    MEM_WRITEBACK,
+    MEM_SHMEM,
+    MEM_HUGE_TOTAL, /* in pages */
+    MEM_HUGE_FREE, /* in pages */
+    MEM_HUGE_SIZE,
+
+    MEM_ENTRY_COUNT
+};
+
+/* /proc/vmstat lines we may look at */
+enum J4statusMemVMEntry {
+    VM_PSWPIN,
+    VM_PSWPOUT,
+    VM_PGMAJFAULT,
+    VM_PGSTEAL_KSWAPD,
+    VM_PGSTEAL_DIRECT,
+    VM_PGSTEAL_KHUGEPAGED,
+    VM_PGSCAN_KSWAPD,
+    VM_PGSCAN_DIRECT,
+    VM_PGSCAN_KHUGEPAGED,
+    VM_OOM_KILL,
+
+    VM_ENTRY_COUNT
+};
+
+/* /sys/devices/system/node/nodeN/meminfo lines we may look at */
+enum J4statusMemNodeEntry {
+    NODE_TOTAL,
+    NODE_FREE,
+    NODE_DIRTY,
+    NODE_WRITEBACK,
+    NODE_FILE_PAGES,
+    NODE_SHMEM,
+    NODE_HUGE_TOTAL, /* in pages */
+    NODE_HUGE_FREE, /* in pages */
+
+    NODE_ENTRY_COUNT
+};
+
+/* memory.events lines we look at */
+enum J4statusMemEventEntry {
+    EVENT_HIGH,
+    EVENT_OOM_KILL,
+
+    EVENT_ENTRY_COUNT
+};
+
+/* single value cgroup files */
+enum J4statusMemCGroupFile {
+    CGROUP_CURRENT,
+    CGROUP_MAX,
+    CGROUP_HIGH,
+    CGROUP_SWAP,
+
+    CGROUP_FILE_COUNT
+};
+
+static const gchar *const _j4status_mem_cgroup_files[] = {
+    [CGROUP_CURRENT] = "memory.current",
+    [CGROUP_MAX]     = "memory.max",
+    [CGROUP_HIGH]    = "memory.high",
+    [CGROUP_SWAP]    = "memory.swap.current",
+};
+
+#define ENTRY_FLAG(entry) (G_GUINT64_CONSTANT(1) << (entry))
+
+/* entries used to compute MemAvailable on kernels older than 3.14 */
+#define AVAILABLE_FALLBACK (ENTRY_FLAG(MEM_FREE) | ENTRY_FLAG(MEM_BUFFERS) | \
+    ENTRY_FLAG(MEM_CACHED))
+
+/* a line is "<key><separator> <value>", the separator is part of the key
+ * here */
+typedef struct {
+    const gchar *name;
+    gsize length;
+} J4statusMemKey;
+
+/* meminfo lines are "<key>: <value> kB" */
+#define MEM_KEY(key) { key ":", sizeof(key) }
+static const J4statusMemKey _j4status_mem_keys[] = {
+    [MEM_TOTAL]     = MEM_KEY("MemTotal"),
+    [MEM_FREE]      = MEM_KEY("MemFree"),
+    [MEM_AVAILABLE] = MEM_KEY("MemAvailable"),
+    [MEM_BUFFERS]   = MEM_KEY("Buffers"),
+    [MEM_CACHED]    = MEM_KEY("Cached"),
+    [MEM_SWAP_TOTAL] = MEM_KEY("SwapTotal"),
+    [MEM_SWAP_FREE]  = MEM_KEY("SwapFree"),
+    [MEM_ZSWAP]      = MEM_KEY("Zswap"),
+    [MEM_ZSWAPPED]   = MEM_KEY("Zswapped"),
+    [MEM_DIRTY]      = MEM_KEY("Dirty"),
+    [MEM_WRITEBACK]  = MEM_KEY("Writeback"),
+    [MEM_SHMEM]      = MEM_KEY("Shmem"),
+    [MEM_HUGE_TOTAL] = MEM_KEY("HugePages_Total"),
+    [MEM_HUGE_FREE]  = MEM_KEY("HugePages_Free"),
+    [MEM_HUGE_SIZE]  = MEM_KEY("Hugepagesize"),
+};
+
+/* node meminfo lines are "Node <id> <key>: <value> kB" */
+static const J4statusMemKey _j4status_mem_node_keys[] = {
+    [NODE_TOTAL]      = MEM_KEY("MemTotal"),
+    [NODE_FREE]       = MEM_KEY("MemFree"),
+    [NODE_DIRTY]      = MEM_KEY("Dirty"),
+    [NODE_WRITEBACK]  = MEM_KEY("Writeback"),
+    [NODE_FILE_PAGES] = MEM_KEY("FilePages"),
+    [NODE_SHMEM]      = MEM_KEY("Shmem"),
+    [NODE_HUGE_TOTAL] = MEM_KEY("HugePages_Total"),
+    [NODE_HUGE_FREE]  = MEM_KEY("HugePages_Free"),
+};
+
+/* vmstat lines are "<key> <value>" */
+#define VM_KEY(key) { key " ", sizeof(key) }
+static const J4statusMemKey _j4status_mem_vm_keys[] = {
+    [VM_PSWPIN]             = VM_KEY("pswpin"),
+    [VM_PSWPOUT]            = VM_KEY("pswpout"),
+    [VM_PGMAJFAULT]         = VM_KEY("pgmajfault"),
+    [VM_PGSTEAL_KSWAPD]     = VM_KEY("pgsteal_kswapd"),
+    [VM_PGSTEAL_DIRECT]     = VM_KEY("pgsteal_direct"),
+    [VM_PGSTEAL_KHUGEPAGED] = VM_KEY("pgsteal_khugepaged"),
+    [VM_PGSCAN_KSWAPD]      = VM_KEY("pgscan_kswapd"),
+    [VM_PGSCAN_DIRECT]      = VM_KEY("pgscan_direct"),
+    [VM_PGSCAN_KHUGEPAGED]  = VM_KEY("pgscan_khugepaged"),
+    [VM_OOM_KILL]           = VM_KEY("oom_kill"),
+};
+
+/* memory.events lines are like vmstat ones */
+static const J4statusMemKey _j4status_mem_event_keys[] = {
+    [EVENT_HIGH]     = VM_KEY("high"),
+    [EVENT_OOM_KILL] = VM_KEY("oom_kill"),
+};
+
+/* indices for _j4status_mem_tokens[] */
+enum J4statusMemToken {
+    TOKEN_USED,
+    TOKEN_AVAILABLE,
+    TOKEN_TOTAL,
+    TOKEN_USED_RATIO,
+    TOKEN_SWAP_USED,
+    TOKEN_SWAP_TOTAL,
+    TOKEN_SWAP_USED_RATIO,
+    TOKEN_CACHED,
+    TOKEN_BUFFERS,
+    TOKEN_DIRTY,
+    TOKEN_WRITEBACK,
+    TOKEN_SHMEM,
+    TOKEN_HUGE_USED,
+    TOKEN_HUGE_TOTAL,
+    TOKEN_SWAP_IN,
+    TOKEN_SWAP_OUT,
+    TOKEN_MAJOR_FAULTS,
+    TOKEN_SCANNED,
+    TOKEN_RECLAIMED,
+    TOKEN_OOM_KILLS,
+    TOKEN_TOP,
+    TOKEN_ZRAM_ORIG,
+    TOKEN_ZRAM_COMPR,
+    TOKEN_ZRAM_USED,
+    TOKEN_ZRAM_RATIO,
+    TOKEN_ZRAM_SAVED,
+    TOKEN_ZSWAP_ORIG,
+    TOKEN_ZSWAP_COMPR,
+    TOKEN_ZSWAP_RATIO,
+    TOKEN_ZSWAP_SAVED,
+
+    TOTAL_TOKEN_COUNT
+};
+
+/* used in j4status_format_string_parse() */
+static const gchar *const _j4status_mem_tokens[] = {
+    [TOKEN_USED]            = "used",
+    [TOKEN_AVAILABLE]       = "avail",
+    [TOKEN_TOTAL]           = "total",
+    [TOKEN_USED_RATIO]      = "p_used",
+    [TOKEN_SWAP_USED]       = "swap_used",
+    [TOKEN_SWAP_TOTAL]      = "swap_total",
+    [TOKEN_SWAP_USED_RATIO] = "p_swap_used",
+    [TOKEN_CACHED]          = "cached",
+    [TOKEN_BUFFERS]         = "buffers",
+    [TOKEN_DIRTY]           = "dirty",
+    [TOKEN_WRITEBACK]       = "writeback",
+    [TOKEN_SHMEM]           = "shmem",
+    [TOKEN_HUGE_USED]       = "huge_used",
+    [TOKEN_HUGE_TOTAL]      = "huge_total",
+    [TOKEN_SWAP_IN]         = "swap_in",
+    [TOKEN_SWAP_OUT]        = "swap_out",
+    [TOKEN_MAJOR_FAULTS]    = "major_faults",
+    [TOKEN_SCANNED]         = "scanned",
+    [TOKEN_RECLAIMED]       = "reclaimed",
+    [TOKEN_OOM_KILLS]       = "oom_kills",
+    [TOKEN_TOP]             = "top",
+    [TOKEN_ZRAM_ORIG]       = "zram_orig",
+    [TOKEN_ZRAM_COMPR]      = "zram_compr",
+    [TOKEN_ZRAM_USED]       = "zram_used",
+    [TOKEN_ZRAM_RATIO]      = "zram_ratio",
+    [TOKEN_ZRAM_SAVED]      = "zram_saved",
+    [TOKEN_ZSWAP_ORIG]      = "zswap_orig",
+    [TOKEN_ZSWAP_COMPR]     = "zswap_compr",
+    [TOKEN_ZSWAP_RATIO]     = "zswap_ratio",
+    [TOKEN_ZSWAP_SAVED]     = "zswap_saved",
+};
+
+#define TOKEN_FLAG(token) (G_GUINT64_CONSTANT(1) << (token))
+
+#define SWAP_ENTRIES (ENTRY_FLAG(MEM_SWAP_TOTAL) | ENTRY_FLAG(MEM_SWAP_FREE))
+#define HUGE_ENTRIES (ENTRY_FLAG(MEM_HUGE_TOTAL) | \
+    ENTRY_FLAG(MEM_HUGE_FREE) | ENTRY_FLAG(MEM_HUGE_SIZE))
+#define ZSWAP_ENTRIES (ENTRY_FLAG(MEM_ZSWAP) | ENTRY_FLAG(MEM_ZSWAPPED))
+
+#define ZRAM_TOKENS (TOKEN_FLAG(TOKEN_ZRAM_ORIG) | \
+    TOKEN_FLAG(TOKEN_ZRAM_COMPR) | TOKEN_FLAG(TOKEN_ZRAM_USED) | \
+    TOKEN_FLAG(TOKEN_ZRAM_RATIO) | TOKEN_FLAG(TOKEN_ZRAM_SAVED))
+#define ZSWAP_TOKENS (TOKEN_FLAG(TOKEN_ZSWAP_ORIG) | \
+    TOKEN_FLAG(TOKEN_ZSWAP_COMPR) | TOKEN_FLAG(TOKEN_ZSWAP_RATIO) | \
+    TOKEN_FLAG(TOKEN_ZSWAP_SAVED))
+
+/* meminfo entries each token needs, MemTotal and MemAvailable are always
+ * read for the section state */
+static const guint64 _j4status_mem_token_entries[TOTAL_TOKEN_COUNT] = {
+    [TOKEN_SWAP_USED]       = SWAP_ENTRIES,
+    [TOKEN_SWAP_TOTAL]      = ENTRY_FLAG(MEM_SWAP_TOTAL),
+    [TOKEN_SWAP_USED_RATIO] = SWAP_ENTRIES,
+    [TOKEN_CACHED]          = ENTRY_FLAG(MEM_CACHED),
+    [TOKEN_BUFFERS]         = ENTRY_FLAG(MEM_BUFFERS),
+    [TOKEN_DIRTY]           = ENTRY_FLAG(MEM_DIRTY),
+    [TOKEN_WRITEBACK]       = ENTRY_FLAG(MEM_WRITEBACK),
+    [TOKEN_SHMEM]           = ENTRY_FLAG(MEM_SHMEM),
+    [TOKEN_HUGE_USED]       = HUGE_ENTRIES,
+    [TOKEN_HUGE_TOTAL]      = ENTRY_FLAG(MEM_HUGE_TOTAL) |
+        ENTRY_FLAG(MEM_HUGE_SIZE),
+    [TOKEN_ZSWAP_ORIG]      = ZSWAP_ENTRIES,
+    [TOKEN_ZSWAP_COMPR]     = ZSWAP_ENTRIES,
+    [TOKEN_ZSWAP_RATIO]     = ZSWAP_ENTRIES,
+    [TOKEN_ZSWAP_SAVED]     = ZSWAP_ENTRIES,
+};
+
+/* vmstat entries each token needs */
+static const guint64 _j4status_mem_token_vm_entries[TOTAL_TOKEN_COUNT] = {
+    [TOKEN_SWAP_IN]      = ENTRY_FLAG(VM_PSWPIN),
+    [TOKEN_SWAP_OUT]     = ENTRY_FLAG(VM_PSWPOUT),
+    [TOKEN_MAJOR_FAULTS] = ENTRY_FLAG(VM_PGMAJFAULT),
+    [TOKEN_SCANNED]      = ENTRY_FLAG(VM_PGSCAN_KSWAPD) |
+        ENTRY_FLAG(VM_PGSCAN_DIRECT) | ENTRY_FLAG(VM_PGSCAN_KHUGEPAGED),
+    [TOKEN_RECLAIMED]    = ENTRY_FLAG(VM_PGSTEAL_KSWAPD) |
+        ENTRY_FLAG(VM_PGSTEAL_DIRECT) | ENTRY_FLAG(VM_PGSTEAL_KHUGEPAGED),
+    [TOKEN_OOM_KILLS]    = ENTRY_FLAG(VM_OOM_KILL),
+};
+
+/* indices for _j4status_mem_node_tokens[] */
+enum J4statusMemNodeToken {
+    NODE_TOKEN_USED,
+    NODE_TOKEN_FREE,
+    NODE_TOKEN_TOTAL,
+    NODE_TOKEN_USED_RATIO,
+    NODE_TOKEN_FILE_PAGES,
+    NODE_TOKEN_DIRTY,
+    NODE_TOKEN_WRITEBACK,
+    NODE_TOKEN_SHMEM,
+    NODE_TOKEN_HUGE_USED,
+    NODE_TOKEN_HUGE_TOTAL,
+
+    NODE_TOKEN_COUNT
+};
+
+/* used in j4status_format_string_parse() for node sections */
+static const gchar *const _j4status_mem_node_tokens[] = {
+    [NODE_TOKEN_USED]       = "used",
+    [NODE_TOKEN_FREE]       = "free",
+    [NODE_TOKEN_TOTAL]      = "total",
+    [NODE_TOKEN_USED_RATIO] = "p_used",
+    [NODE_TOKEN_FILE_PAGES] = "cached",
+    [NODE_TOKEN_DIRTY]      = "dirty",
+    [NODE_TOKEN_WRITEBACK]  = "writeback",
+    [NODE_TOKEN_SHMEM]      = "shmem",
+    [NODE_TOKEN_HUGE_USED]  = "huge_used",
+    [NODE_TOKEN_HUGE_TOTAL] = "huge_total",
+};
+
+/* node meminfo entries each node token needs, MemTotal and MemFree are
+ * always read for the section state */
+static const guint64 _j4status_mem_node_token_entries[NODE_TOKEN_COUNT] = {
+    [NODE_TOKEN_FILE_PAGES] = ENTRY_FLAG(NODE_FILE_PAGES),
+    [NODE_TOKEN_DIRTY]      = ENTRY_FLAG(NODE_DIRTY),
+    [NODE_TOKEN_WRITEBACK]  = ENTRY_FLAG(NODE_WRITEBACK),
+    [NODE_TOKEN_SHMEM]      = ENTRY_FLAG(NODE_SHMEM),
+    [NODE_TOKEN_HUGE_USED]  = ENTRY_FLAG(NODE_HUGE_TOTAL) |
+        ENTRY_FLAG(NODE_HUGE_FREE),
+    [NODE_TOKEN_HUGE_TOTAL] = ENTRY_FLAG(NODE_HUGE_TOTAL),
+};
+
+/* node tokens needing the huge page size from /proc/meminfo */
+#define NODE_HUGE_TOKENS (TOKEN_FLAG(NODE_TOKEN_HUGE_USED) | \
+    TOKEN_FLAG(NODE_TOKEN_HUGE_TOTAL))
+
+/* indices for _j4status_mem_cgroup_tokens[] */
+enum J4statusMemCGroupToken {
+    CGROUP_TOKEN_USAGE,
+    CGROUP_TOKEN_MAX,
+    CGROUP_TOKEN_HIGH,
+    CGROUP_TOKEN_SWAP,
+    CGROUP_TOKEN_USED_RATIO,
+    CGROUP_TOKEN_OOM_KILLS,
+    CGROUP_TOKEN_HIGH_BREACHES,
+
+    CGROUP_TOKEN_COUNT
+};
+
+/* used in j4status_format_string_parse() for cgroup sections */
+static const gchar *const _j4status_mem_cgroup_tokens[] = {
+    [CGROUP_TOKEN_USAGE]         = "usage",
+    [CGROUP_TOKEN_MAX]           = "max",
+    [CGROUP_TOKEN_HIGH]          = "high",
+    [CGROUP_TOKEN_SWAP]          = "swap",
+    [CGROUP_TOKEN_USED_RATIO]    = "p_used",
+    [CGROUP_TOKEN_OOM_KILLS]     = "oom_kills",
+    [CGROUP_TOKEN_HIGH_BREACHES] = "high_breaches",
+};
+
+/* data for _j4status_mem_format_callback() */
+struct J4statusMemFormatData {
+    guint64 bytes[TOTAL_TOKEN_COUNT];
+    gdouble ratios[TOTAL_TOKEN_COUNT];
+    gdouble rates[TOTAL_TOKEN_COUNT];
+    guint64 oom_kills;
+    guint64 set_tokens; /* for cgroup sections and zram/zswap tokens */
+    const gchar *top;
+};
+
+/* a key-value file, kept open and sampled by _j4status_mem_file_read() */
+typedef struct {
+    const gchar *path;
+    const J4statusMemKey *keys;
+    guint num_keys;
+    gsize prefix; /* length of what comes before the keys */
+    gchar separator; /* last character of the keys */
+    gint fd; /* kept open while started */
+    gchar *buffer;
+    gsize buffer_size;
+    guint64 wanted; /* entries to look for, from the tokens used */
+    guint64 missing; /* wanted entries this kernel does not have */
+    /* where each entry was found in the last read, -1 if not yet;
+     * lines only move when a value gets wider, so these mostly hold */
+    gssize *offsets;
+    guint64 *values;
+} J4statusMemFile;
+
+const gchar PROC_MEMINFO[] = "/proc/meminfo";
+const gchar PROC_VMSTAT[] = "/proc/vmstat";
+const gchar NODE_ONLINE[] = "/sys/devices/system/node/online";
+const gchar NODE_MEMINFO[] = "/sys/devices/system/node/node%u/meminfo";
+
+/* cgroup v2 hierarchy root */
+const gchar CGROUP_ROOT[] = "/sys/fs/cgroup";
+
+/* zram devices, each has an mm_stat */
+const gchar SYS_BLOCK[] = "/sys/block";
+
+/* zswap statistics for kernels without Zswap in PROC_MEMINFO,
+ * debugfs is usually only readable by root */
+const gchar ZSWAP_POOL_SIZE[] = "/sys/kernel/debug/zswap/pool_total_size";
+const gchar ZSWAP_STORED_PAGES[] = "/sys/kernel/debug/zswap/stored_pages";
+
+/* a NUMA node section */
+typedef struct {
+    J4statusSection *section;
+    gchar *path;
+    J4statusMemFile meminfo; /* values in kB */
+} J4statusMemNode;
+
+/* a cgroup v2 section */
+typedef struct {
+    J4statusPluginContext *context;
+    J4statusSection *section;
+    gchar *path; /* the cgroup directory */
+    /* kept open while started and the cgroup exists, -1 otherwise
+     * (memory.max and memory.high do not exist at the root,
+     * memory.swap.current without swap accounting) */
+    gint fds[CGROUP_FILE_COUNT];
+    guint64 values[CGROUP_FILE_COUNT]; /* in bytes, G_MAXUINT64 for "max" */
+    gchar *events_path;
+    J4statusMemFile events; /* watched, the kernel notifies changes */
+    guint watch_id;
+    guint64 events_start[EVENT_ENTRY_COUNT]; /* when opened */
+    guint64 events_last[EVENT_ENTRY_COUNT]; /* on the last tick */
+} J4statusMemCGroup;
+
+/* where processes are */
+const gchar PROC[] = "/proc";
+
+/* a process of the top index */
+typedef struct {
+    guint32 pid;
+    gboolean gone; /* dropped from the index at the end of the tick */
+    gboolean pss_denied; /* smaps_rollup is not ours to read, RSS is used */
+    guint64 rss; /* in pages, from statm */
+    guint64 pss; /* in kB, from smaps_rollup */
+    guint64 pss_tick; /* when pss was read, 0 if never */
+} J4statusMemProcess;
+
+/* an entry of the top list */
+typedef struct {
+    guint32 pid;
+    guint64 bytes;
+} J4statusMemTopEntry;
+
+/* getdents64() record, glibc only got a wrapper in 2.30 */
+struct J4statusMemDirent {
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    gchar d_name[];
+};
+
 struct _J4statusPluginContext {
     J4statusSection *section;
     guint period;
     guint timeout_id;
     guint good_threshold;
     guint bad_threshold;
+    gdouble bad_major_faults; /* per second, 0 to disable */
+    gdouble bad_swap_out; /* pages per second, 0 to disable */
+    J4statusFormatString *format;
+    guint64 used_tokens;
+    J4statusMemFile meminfo; /* values in kB */
+    J4statusMemFile vmstat; /* only opened if some entry is wanted */
+    guint64 vm_last[VM_ENTRY_COUNT];
+    gint64 vm_time; /* of the last read, monotonic, 0 before the first */
+    guint64 oom_kills; /* since start */
+    J4statusMemNode *nodes;
+    guint num_nodes;
+    J4statusFormatString *node_format;
+    guint64 node_used_tokens;
+    GSList *cgroups;
+    J4statusFormatString *cgroup_format;
+    guint64 cgroup_used_tokens;
+    /* top token, see _j4status_mem_top_update() */
+    guint top_count;
+    gboolean top_by_pss;
+    guint64 pss_period; /* in ticks */
+    guint64 page_size;
+    gint proc_fd; /* PROC, kept open while started if top is used */
+    gint loadavg_fd; /* to tell whether processes were created */
+    guint64 last_pid; /* at the last scan of PROC */
+    gchar *dents; /* getdents64() buffer */
+    GArray *processes; /* the index, J4statusMemProcess sorted by pid */
+    guint64 tick;
+    guint32 statm_pid; /* where the statm walk goes on from */
+    guint32 pss_pid; /* where the PSS read budget ran out */
+    J4statusMemTopEntry *top; /* top_count entries */
+    guint64 top_threshold; /* in bytes, the last entry if top was full */
+    GString *top_string;
+    /* zram and zswap tokens, see _j4status_mem_zram_read() */
+    GArray *zram_fds; /* mm_stat of each device, found on start */
+    gint zswap_pool_fd; /* debugfs fallbacks, -1 if unused */
+    gint zswap_stored_fd;
 };
 
+/*
+ * Reads a decimal number, skipping leading blanks
+ * Returns the position right after the number
+ */
+static const gchar *
+_j4status_mem_scan_number(const gchar *marker, guint64 *value)
+{
+    while (*marker == ' ')
+        marker++;
+    guint64 result = 0;
+    while (*marker >= '0' && *marker <= '9')
+        result = result * 10 + (guint64) (*marker++ - '0');
+    *value = result;
+    return marker;
+}
+
+static void
+_j4status_mem_file_init(J4statusMemFile *file, const gchar *path,
+    const J4statusMemKey *keys, guint num_keys, gsize prefix,
+    gchar separator, gsize buffer_size)
+{
+    file->path = path;
+    file->keys = keys;
+    file->num_keys = num_keys;
+    file->prefix = prefix;
+    file->separator = separator;
+    file->fd = -1;
+    file->buffer_size = buffer_size;
+    file->buffer = g_new(gchar, file->buffer_size);
+    file->wanted = 0;
+    file->missing = 0;
+    file->offsets = g_new(gssize, num_keys);
+    file->values = g_new0(guint64, num_keys);
+    for (guint entry = 0; entry < num_keys; entry++)
+        file->offsets[entry] = -1;
+}
+
+static void
+_j4status_mem_file_clear(J4statusMemFile *file)
+{
+    g_free(file->buffer);
+    g_free(file->offsets);
+    g_free(file->values);
+}
+
 static gboolean
-_j4status_mem_update(gpointer user_data)
+_j4status_mem_file_open(J4statusMemFile *file)
 {
-    J4statusPluginContext *context = user_data;
+    file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0)
+        g_warning("Could not open %s: %s", file->path, g_strerror(errno));
+    return file->fd >= 0;
+}
 
-    double mem_percent = -1;
-
-    FILE *f = fopen("/proc/meminfo", "r");
-    if (f) {
-        unsigned long val, total = 0, available = 0;
-        char key[21];
-        while (fscanf(f, "%20[^:]: %lu%*[^\n]\n", key, &val) >= 2) {
-            if (strcmp(key, "MemTotal") == 0)
-                total = val;
-            else if (strcmp(key, "MemAvailable") == 0) {
-                available = val;
-                mem_percent = 100.0 * (total - available) / total;
+static void
+_j4status_mem_file_close(J4statusMemFile *file)
+{
+    if (file->fd >= 0)
+        close(file->fd);
+    file->fd = -1;
+}
+
+/*
+ * Tells whether the line starting at "offset" is the one of "entry",
+ * and reads its value if so
+ */
+static gboolean
+_j4status_mem_parse_entry(J4statusMemFile *file, gsize size, guint entry,
+    gsize offset)
+{
+    gsize length = file->keys[entry].length;
+    const gchar *key = file->buffer + offset + file->prefix;
+    if (offset + file->prefix + length > size ||
+        (offset > 0 && file->buffer[offset - 1] != '\n') ||
+        memcmp(key, file->keys[entry].name, length) != 0)
+        return FALSE;
+    _j4status_mem_scan_number(key + length, &file->values[entry]);
+    file->offsets[entry] = offset;
+    return TRUE;
+}
+
+/*
+ * Walks the lines until all the entries missing from "found" are,
+ * recording where they are for the next reads
+ * Returns the updated "found"
+ */
+static guint64
+_j4status_mem_scan_lines(J4statusMemFile *file, gsize size, guint64 found)
+{
+    const gchar *marker = file->buffer;
+    while (found != file->wanted && *marker) {
+        if (strnlen(marker, file->prefix) < file->prefix)
+            break;
+        const gchar *separator = strchr(marker + file->prefix,
+            file->separator);
+        if (separator == NULL)
+            break;
+        gsize length = separator + 1 - (marker + file->prefix);
+        for (guint entry = 0; entry < file->num_keys; entry++) {
+            if ((file->wanted & ~found & ENTRY_FLAG(entry)) &&
+                file->keys[entry].length == length &&
+                _j4status_mem_parse_entry(file, size, entry,
+                    marker - file->buffer)) {
+                found |= ENTRY_FLAG(entry);
                 break;
             }
         }
-        fclose(f);
+        marker = strchr(separator, '\n');
+        if (marker == NULL)
+            break;
+        marker++;
+    }
+    return found;
+}
+
+/*
+ * Samples a file through its kept open fd
+ * Entries are first looked for where they were last time,
+ * the lines are only walked if one moved or was never found
+ * Wanted entries not in the file are moved to "missing" and read as 0
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_mem_file_read(J4statusMemFile *file)
+{
+    gssize size;
+    while (TRUE) {
+        size = pread(file->fd, file->buffer, file->buffer_size - 1, 0);
+        if (size < 0) {
+            g_warning("Error reading %s: %s", file->path, g_strerror(errno));
+            return FALSE;
+        }
+        if ((gsize) size < file->buffer_size - 1)
+            break;
+        file->buffer_size *= 2;
+        file->buffer = g_realloc(file->buffer, file->buffer_size);
+    }
+    file->buffer[size] = '\0';
+
+    guint64 found = 0;
+    for (guint entry = 0; entry < file->num_keys; entry++) {
+        if ((file->wanted & ENTRY_FLAG(entry)) &&
+            file->offsets[entry] >= 0 &&
+            _j4status_mem_parse_entry(file, size, entry,
+                file->offsets[entry]))
+            found |= ENTRY_FLAG(entry);
+    }
+    if (found == file->wanted)
+        return TRUE;
+
+    found = _j4status_mem_scan_lines(file, size, found);
+    for (guint entry = 0; entry < file->num_keys; entry++) {
+        if (file->wanted & ~found & ENTRY_FLAG(entry)) {
+            g_debug("mem: No %.*s in %s", (gint) file->keys[entry].length - 1,
+                file->keys[entry].name, file->path);
+            file->offsets[entry] = -1;
+            file->values[entry] = 0;
+        }
+    }
+    file->missing |= file->wanted & ~found;
+    file->wanted &= found;
+    return TRUE;
+}
+
+/*
+ * Samples PROC_MEMINFO, estimating MemAvailable if needed
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_mem_meminfo_read(J4statusPluginContext *context)
+{
+    J4statusMemFile *file = &context->meminfo;
+    if (!_j4status_mem_file_read(file))
+        return FALSE;
+
+    guint64 fallback = AVAILABLE_FALLBACK & ~file->wanted & ~file->missing;
+    if ((file->missing & ENTRY_FLAG(MEM_AVAILABLE)) && fallback != 0) {
+        g_message("mem: No MemAvailable in %s, estimating it", file->path);
+        file->wanted |= fallback;
+        if (!_j4status_mem_file_read(file))
+            return FALSE;
+    }
+    if (file->missing & ENTRY_FLAG(MEM_AVAILABLE))
+        file->values[MEM_AVAILABLE] = file->values[MEM_FREE] +
+            file->values[MEM_BUFFERS] + file->values[MEM_CACHED];
+    return file->values[MEM_TOTAL] > 0;
+}
+
+/*
+ * Samples PROC_VMSTAT and computes the per-second rates of its counters
+ * "oom_kills" gets the number of OOM kills since the last read
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_mem_vmstat_read(J4statusPluginContext *context,
+    gdouble rates[VM_ENTRY_COUNT], guint64 *oom_kills)
+{
+    J4statusMemFile *file = &context->vmstat;
+    if (!_j4status_mem_file_read(file))
+        return FALSE;
+
+    gint64 now = g_get_monotonic_time();
+    gdouble elapsed = MAX(now - context->vm_time, 1);
+    gboolean first = (context->vm_time == 0);
+    for (guint entry = 0; entry < VM_ENTRY_COUNT; entry++) {
+        guint64 delta = file->values[entry] - context->vm_last[entry];
+        rates[entry] = first ? 0 : 1.0 * G_USEC_PER_SEC * delta / elapsed;
+        context->vm_last[entry] = file->values[entry];
+        if (entry == VM_OOM_KILL && !first)
+            *oom_kills = delta;
+    }
+    context->vm_time = now;
+    return TRUE;
+}
+
+/*
+ * J4statusFormatStringReplaceCallback instance for node sections
+ */
+static GVariant *
+_j4status_mem_node_format_callback(G_GNUC_UNUSED const gchar *token,
+    guint64 value, gconstpointer user_data)
+{
+    const struct J4statusMemFormatData *fdata = user_data;
+    if (value >= NODE_TOKEN_COUNT)
+        return NULL;
+    if (value == NODE_TOKEN_USED_RATIO)
+        return g_variant_new_double(fdata->ratios[value]);
+    return g_variant_new_uint64(fdata->bytes[value]);
+}
+
+/*
+ * Samples all the NUMA nodes in one go
+ * Node sections use the same thresholds as the global one
+ */
+static void
+_j4status_mem_nodes_update(J4statusPluginContext *context)
+{
+    guint64 huge_size = context->meminfo.values[MEM_HUGE_SIZE];
+    for (guint idx = 0; idx < context->num_nodes; idx++) {
+        J4statusMemNode *node = &context->nodes[idx];
+        if (node->meminfo.fd < 0 || !_j4status_mem_file_read(&node->meminfo) ||
+            node->meminfo.values[NODE_TOTAL] == 0) {
+            j4status_section_set_state(node->section,
+                J4STATUS_STATE_UNAVAILABLE);
+            j4status_section_set_value(node->section, g_strdup("Error"));
+            continue;
+        }
+
+        const guint64 *values = node->meminfo.values;
+        guint64 total = values[NODE_TOTAL];
+        guint64 free = MIN(values[NODE_FREE], total);
+        guint64 huge_used = values[NODE_HUGE_TOTAL] -
+            MIN(values[NODE_HUGE_FREE], values[NODE_HUGE_TOTAL]);
+        double percent = 100.0 * (total - free) / total;
+        struct J4statusMemFormatData fdata = {
+            .bytes = {
+                [NODE_TOKEN_USED]       = (total - free) * 1024,
+                [NODE_TOKEN_FREE]       = free * 1024,
+                [NODE_TOKEN_TOTAL]      = total * 1024,
+                [NODE_TOKEN_FILE_PAGES] = values[NODE_FILE_PAGES] * 1024,
+                [NODE_TOKEN_DIRTY]      = values[NODE_DIRTY] * 1024,
+                [NODE_TOKEN_WRITEBACK]  = values[NODE_WRITEBACK] * 1024,
+                [NODE_TOKEN_SHMEM]      = values[NODE_SHMEM] * 1024,
+                [NODE_TOKEN_HUGE_USED]  = huge_used * huge_size * 1024,
+                [NODE_TOKEN_HUGE_TOTAL] = values[NODE_HUGE_TOTAL] *
+                    huge_size * 1024,
+            },
+            .ratios = {
+                [NODE_TOKEN_USED_RATIO] = percent,
+            },
+        };
+
+        j4status_section_set_state(node->section,
+            percent < context->good_threshold ? J4STATUS_STATE_GOOD :
+            percent > context->bad_threshold ? J4STATUS_STATE_BAD :
+                J4STATUS_STATE_AVERAGE);
+        j4status_section_set_value(node->section,
+            j4status_format_string_replace(context->node_format,
+                _j4status_mem_node_format_callback, &fdata));
+    }
+}
+
+/*
+ * J4statusFormatStringReplaceCallback instance for cgroup sections
+ * Limits set to "max" and missing files give unset tokens
+ */
+static GVariant *
+_j4status_mem_cgroup_format_callback(G_GNUC_UNUSED const gchar *token,
+    guint64 value, gconstpointer user_data)
+{
+    const struct J4statusMemFormatData *fdata = user_data;
+    if (value >= CGROUP_TOKEN_COUNT ||
+        (fdata->set_tokens & TOKEN_FLAG(value)) == 0)
+        return NULL;
+    if (value == CGROUP_TOKEN_USED_RATIO)
+        return g_variant_new_double(fdata->ratios[value]);
+    return g_variant_new_uint64(fdata->bytes[value]);
+}
+
+/*
+ * Reads a single value cgroup file
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_mem_cgroup_read_value(gint fd, guint64 *value)
+{
+    gchar buffer[32];
+    gssize size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0)
+        return FALSE;
+    buffer[size] = '\0';
+    if (strncmp(buffer, "max", 3) == 0)
+        *value = G_MAXUINT64;
+    else
+        _j4status_mem_scan_number(buffer, value);
+    return TRUE;
+}
+
+static void _j4status_mem_cgroup_close(gpointer data, gpointer user_data);
+
+/*
+ * Displays a cgroup, reading its single value files
+ * Usage is against the lowest of memory.max and memory.high;
+ * a high breach since the last tick makes the section average at least,
+ * an OOM kill makes it bad
+ */
+static void
+_j4status_mem_cgroup_refresh(J4statusMemCGroup *cgroup)
+{
+    J4statusPluginContext *context = cgroup->context;
+    for (guint file = 0; file < CGROUP_FILE_COUNT; file++) {
+        cgroup->values[file] = G_MAXUINT64;
+        if (cgroup->fds[file] >= 0 &&
+            !_j4status_mem_cgroup_read_value(cgroup->fds[file],
+                &cgroup->values[file]) && file == CGROUP_CURRENT) {
+            /* the cgroup was removed, it may come back later */
+            _j4status_mem_cgroup_close(cgroup, NULL);
+            j4status_section_set_state(cgroup->section,
+                J4STATUS_STATE_UNAVAILABLE);
+            j4status_section_set_value(cgroup->section, NULL);
+            return;
+        }
+    }
+
+    const guint64 *values = cgroup->values;
+    const guint64 *events = cgroup->events.values;
+    guint64 limit = MIN(values[CGROUP_MAX], values[CGROUP_HIGH]);
+    gdouble percent = (limit == G_MAXUINT64) ? 0 :
+        100.0 * values[CGROUP_CURRENT] / MAX(limit, 1);
+    struct J4statusMemFormatData fdata = {
+        .bytes = {
+            [CGROUP_TOKEN_USAGE] = values[CGROUP_CURRENT],
+            [CGROUP_TOKEN_MAX]   = values[CGROUP_MAX],
+            [CGROUP_TOKEN_HIGH]  = values[CGROUP_HIGH],
+            [CGROUP_TOKEN_SWAP]  = values[CGROUP_SWAP],
+            [CGROUP_TOKEN_OOM_KILLS] = events[EVENT_OOM_KILL] -
+                cgroup->events_start[EVENT_OOM_KILL],
+            [CGROUP_TOKEN_HIGH_BREACHES] = events[EVENT_HIGH] -
+                cgroup->events_start[EVENT_HIGH],
+        },
+        .ratios = {
+            [CGROUP_TOKEN_USED_RATIO] = percent,
+        },
+        .set_tokens = TOKEN_FLAG(CGROUP_TOKEN_USAGE) |
+            TOKEN_FLAG(CGROUP_TOKEN_OOM_KILLS) |
+            TOKEN_FLAG(CGROUP_TOKEN_HIGH_BREACHES),
+    };
+    if (values[CGROUP_MAX] != G_MAXUINT64)
+        fdata.set_tokens |= TOKEN_FLAG(CGROUP_TOKEN_MAX);
+    if (values[CGROUP_HIGH] != G_MAXUINT64)
+        fdata.set_tokens |= TOKEN_FLAG(CGROUP_TOKEN_HIGH);
+    if (values[CGROUP_SWAP] != G_MAXUINT64)
+        fdata.set_tokens |= TOKEN_FLAG(CGROUP_TOKEN_SWAP);
+    if (limit != G_MAXUINT64)
+        fdata.set_tokens |= TOKEN_FLAG(CGROUP_TOKEN_USED_RATIO);
+
+    J4statusState state = J4STATUS_STATE_NO_STATE;
+    if (limit != G_MAXUINT64)
+        state = percent < context->good_threshold ? J4STATUS_STATE_GOOD :
+            percent > context->bad_threshold ? J4STATUS_STATE_BAD :
+                J4STATUS_STATE_AVERAGE;
+    if (events[EVENT_HIGH] > cgroup->events_last[EVENT_HIGH] &&
+        state != J4STATUS_STATE_BAD)
+        state = J4STATUS_STATE_AVERAGE;
+    if (events[EVENT_OOM_KILL] > cgroup->events_last[EVENT_OOM_KILL])
+        state = J4STATUS_STATE_BAD;
+    j4status_section_set_state(cgroup->section, state);
+    j4status_section_set_value(cgroup->section,
+        j4status_format_string_replace(context->cgroup_format,
+            _j4status_mem_cgroup_format_callback, &fdata));
+}
+
+/*
+ * GUnixFDSourceFunc instance
+ * Called by the kernel when memory.events changes,
+ * so that breaches show up right away
+ */
+static gboolean
+_j4status_mem_cgroup_event(G_GNUC_UNUSED gint fd,
+    G_GNUC_UNUSED GIOCondition condition, gpointer user_data)
+{
+    J4statusMemCGroup *cgroup = user_data;
+    if (!_j4status_mem_file_read(&cgroup->events)) {
+        cgroup->watch_id = 0;
+        _j4status_mem_cgroup_close(cgroup, NULL);
+        j4status_section_set_state(cgroup->section,
+            J4STATUS_STATE_UNAVAILABLE);
+        j4status_section_set_value(cgroup->section, NULL);
+        return G_SOURCE_REMOVE;
+    }
+    _j4status_mem_cgroup_refresh(cgroup);
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Opens the files of a cgroup and watches its memory.events
+ * Returns FALSE (quietly, cgroups come and go) if it does not exist
+ */
+static gboolean
+_j4status_mem_cgroup_open(J4statusMemCGroup *cgroup)
+{
+    for (guint file = 0; file < CGROUP_FILE_COUNT; file++) {
+        gchar *path = g_build_filename(cgroup->path,
+            _j4status_mem_cgroup_files[file], NULL);
+        cgroup->fds[file] = open(path, O_RDONLY | O_CLOEXEC);
+        g_free(path);
+    }
+    cgroup->events.fd = open(cgroup->events_path, O_RDONLY | O_CLOEXEC);
+    if (cgroup->fds[CGROUP_CURRENT] < 0 || cgroup->events.fd < 0 ||
+        !_j4status_mem_file_read(&cgroup->events)) {
+        _j4status_mem_cgroup_close(cgroup, NULL);
+        return FALSE;
+    }
+    memcpy(cgroup->events_start, cgroup->events.values,
+        sizeof(cgroup->events_start));
+    memcpy(cgroup->events_last, cgroup->events.values,
+        sizeof(cgroup->events_last));
+    cgroup->watch_id = g_unix_fd_add(cgroup->events.fd, G_IO_PRI,
+        _j4status_mem_cgroup_event, cgroup);
+    return TRUE;
+}
+
+/*
+ * GFunc instance
+ * The evil twin of _j4status_mem_cgroup_open()
+ */
+static void
+_j4status_mem_cgroup_close(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusMemCGroup *cgroup = data;
+    if (cgroup->watch_id > 0)
+        g_source_remove(cgroup->watch_id);
+    cgroup->watch_id = 0;
+    _j4status_mem_file_close(&cgroup->events);
+    for (guint file = 0; file < CGROUP_FILE_COUNT; file++) {
+        if (cgroup->fds[file] >= 0)
+            close(cgroup->fds[file]);
+        cgroup->fds[file] = -1;
+    }
+}
+
+/*
+ * GFunc instance
+ * Called each tick, memory.events is only re-read on notifications
+ */
+static void
+_j4status_mem_cgroup_update(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusMemCGroup *cgroup = data;
+    if (cgroup->fds[CGROUP_CURRENT] < 0 &&
+        !_j4status_mem_cgroup_open(cgroup)) {
+        j4status_section_set_state(cgroup->section,
+            J4STATUS_STATE_UNAVAILABLE);
+        j4status_section_set_value(cgroup->section, NULL);
+        return;
+    }
+    _j4status_mem_cgroup_refresh(cgroup);
+    memcpy(cgroup->events_last, cgroup->events.values,
+        sizeof(cgroup->events_last));
+}
+
+/*
+ * GDestroyNotify instance
+ * Called on freeing cgroup list
+ */
+static void
+_j4status_mem_cgroup_free(gpointer data)
+{
+    J4statusMemCGroup *cgroup = data;
+    _j4status_mem_cgroup_close(cgroup, NULL);
+    j4status_section_free(cgroup->section);
+    _j4status_mem_file_clear(&cgroup->events);
+    g_free(cgroup->events_path);
+    g_free(cgroup->path);
+    g_free(cgroup);
+}
+
+/*
+ * Reads the start of a process file, relative to PROC
+ * Returns the size read, -1 with errno set on error
+ */
+static gssize
+_j4status_mem_process_read(J4statusPluginContext *context, guint32 pid,
+    const gchar *file, gchar buffer[PID_FILE_SIZE])
+{
+    gchar path[32];
+    g_snprintf(path, sizeof(path), "%u/%s", pid, file);
+    gint fd = openat(context->proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    gssize size = pread(fd, buffer, PID_FILE_SIZE - 1, 0);
+    gint error = errno;
+    close(fd);
+    errno = error;
+    if (size >= 0)
+        buffer[size] = '\0';
+    return size;
+}
+
+/*
+ * Finds the first process from pid on, among the count first of the index
+ * Returns its position, count if there is none
+ */
+static guint
+_j4status_mem_process_find(J4statusPluginContext *context, guint count,
+    guint32 pid)
+{
+    const J4statusMemProcess *processes =
+        (const J4statusMemProcess *) context->processes->data;
+    guint low = 0, high = count;
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        if (processes[middle].pid < pid)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+ * GCompareFunc instance
+ * Sorts the index by pid
+ */
+static gint
+_j4status_mem_process_compare(gconstpointer a, gconstpointer b)
+{
+    const J4statusMemProcess *process_a = a, *process_b = b;
+    return (process_a->pid > process_b->pid) -
+        (process_a->pid < process_b->pid);
+}
+
+/*
+ * Reads the RSS of a process
+ * Marks it gone if it cannot, kernel threads get 0
+ */
+static void
+_j4status_mem_process_refresh(J4statusPluginContext *context,
+    J4statusMemProcess *process)
+{
+    gchar buffer[PID_FILE_SIZE];
+    /* "size resident shared ...", in pages */
+    if (_j4status_mem_process_read(context, process->pid, "statm",
+            buffer) <= 0) {
+        process->gone = TRUE;
+        return;
+    }
+    guint64 size;
+    _j4status_mem_scan_number(_j4status_mem_scan_number(buffer, &size),
+        &process->rss);
+}
+
+/*
+ * Adds the processes created since the last scan to the index,
+ * reading their RSS right away
+ * The last pid allocated, from /proc/loadavg, tells whether there are any;
+ * known ones are only looked up, their files are read by the walk anyway
+ */
+static void
+_j4status_mem_top_scan(J4statusPluginContext *context)
+{
+    gchar buffer[PID_FILE_SIZE];
+    gssize size = pread(context->loadavg_fd, buffer, sizeof(buffer) - 1, 0);
+    if (size > 0) {
+        /* "0.00 0.01 0.05 1/123 4567" */
+        buffer[size] = '\0';
+        const gchar *last = strrchr(g_strchomp(buffer), ' ');
+        guint64 last_pid;
+        _j4status_mem_scan_number(last ? last : buffer, &last_pid);
+        if (last_pid == context->last_pid)
+            return;
+        context->last_pid = last_pid;
+    }
+
+    if (lseek(context->proc_fd, 0, SEEK_SET) < 0) {
+        g_warning("Error rewinding %s: %s", PROC, g_strerror(errno));
+        return;
+    }
+    /* PROC lists pids in order, so new ones mostly go at the end */
+    guint known = context->processes->len;
+    gboolean sorted = TRUE;
+    while ((size = syscall(SYS_getdents64, context->proc_fd, context->dents,
+                DENTS_SIZE)) > 0) {
+        for (gssize offset = 0; offset < size;) {
+            const struct J4statusMemDirent *dirent =
+                (gconstpointer) (context->dents + offset);
+            offset += dirent->d_reclen;
+            if (dirent->d_name[0] < '1' || dirent->d_name[0] > '9')
+                continue;
+            guint64 pid;
+            _j4status_mem_scan_number(dirent->d_name, &pid);
+            guint idx = _j4status_mem_process_find(context, known, pid);
+            if (idx < known && g_array_index(context->processes,
+                    J4statusMemProcess, idx).pid == pid)
+                continue;
+            J4statusMemProcess process = { .pid = pid };
+            _j4status_mem_process_refresh(context, &process);
+            if (process.gone)
+                continue;
+            if (context->processes->len > 0 &&
+                g_array_index(context->processes, J4statusMemProcess,
+                    context->processes->len - 1).pid > pid)
+                sorted = FALSE;
+            g_array_append_val(context->processes, process);
+        }
+    }
+    if (size < 0)
+        g_warning("Error reading %s: %s", PROC, g_strerror(errno));
+    if (!sorted)
+        g_array_sort(context->processes, _j4status_mem_process_compare);
+}
+
+/*
+ * Refreshes the process index and keeps the top_count largest processes
+ * RSS comes from statm, which is cheap, but not free with thousands
+ * of processes: each tick reads it for the shown processes and
+ * STATM_READS_PER_TICK others, walking the index by pid from where the
+ * last tick stopped;
+ * PSS from smaps_rollup, which has the kernel walk the whole address space,
+ * so only for processes which could make it to the top (PSS is never
+ * more than RSS), at most every pss_period ticks each,
+ * and PSS_READS_PER_TICK at most, the walk starting where they ran out
+ */
+static void
+_j4status_mem_top_update(J4statusPluginContext *context)
+{
+    gchar buffer[PID_FILE_SIZE];
+    guint num_top = 0;
+    guint pss_reads = (context->tick == 0) ? G_MAXUINT : PSS_READS_PER_TICK;
+
+    context->tick++;
+    _j4status_mem_top_scan(context);
+    J4statusMemProcess *processes =
+        (J4statusMemProcess *) context->processes->data;
+    guint count = context->processes->len;
+    for (guint idx = 0; idx < context->top_count; idx++) {
+        guint found = _j4status_mem_process_find(context, count,
+            context->top[idx].pid);
+        if (found < count && processes[found].pid == context->top[idx].pid)
+            _j4status_mem_process_refresh(context, &processes[found]);
+    }
+    guint start = _j4status_mem_process_find(context, count,
+        context->statm_pid);
+    guint statm_reads = MIN(count, STATM_READS_PER_TICK);
+    for (guint step = 0; step < statm_reads; step++)
+        _j4status_mem_process_refresh(context,
+            &processes[(start + step) % count]);
+    if (count > 0)
+        context->statm_pid = processes[(start + statm_reads) % count].pid;
+
+    /* gone processes are dropped */
+    guint kept = 0;
+    for (guint idx = 0; idx < count; idx++)
+        if (!processes[idx].gone)
+            processes[kept++] = processes[idx];
+    g_array_set_size(context->processes, kept);
+    count = kept;
+
+    start = _j4status_mem_process_find(context, count, context->pss_pid);
+    for (guint step = 0; step < count; step++) {
+        guint idx = (start + step) % count;
+        J4statusMemProcess *process = &processes[idx];
+        /* kernel threads have no memory */
+        if (process->rss == 0)
+            continue;
+
+        guint64 bytes = process->rss * context->page_size;
+        if (context->top_by_pss && !process->pss_denied) {
+            if (bytes >= context->top_threshold && pss_reads > 0 &&
+                (process->pss_tick == 0 ||
+                    context->tick - process->pss_tick >= context->pss_period)) {
+                if (--pss_reads == 0)
+                    context->pss_pid = processes[(idx + 1) % count].pid;
+                if (_j4status_mem_process_read(context, process->pid,
+                        "smaps_rollup", buffer) > 0) {
+                    const gchar *pss = strstr(buffer, "\nPss:");
+                    if (pss != NULL)
+                        _j4status_mem_scan_number(pss + strlen("\nPss:"),
+                            &process->pss);
+                    process->pss_tick = context->tick;
+                } else if (errno == EACCES || errno == EPERM) {
+                    process->pss_denied = TRUE;
+                }
+            }
+            /* never read, so too small to matter */
+            if (!process->pss_denied && process->pss_tick == 0)
+                continue;
+            if (!process->pss_denied)
+                bytes = MIN(process->pss * 1024, bytes);
+        }
+
+        /* top_count is small, so a sorted insertion is the way to go */
+        guint rank = MIN(num_top, context->top_count - 1);
+        if (num_top == context->top_count &&
+            bytes <= context->top[rank].bytes)
+            continue;
+        for (; rank > 0 && context->top[rank - 1].bytes < bytes; rank--)
+            context->top[rank] = context->top[rank - 1];
+        context->top[rank].pid = process->pid;
+        context->top[rank].bytes = bytes;
+        num_top = MIN(num_top + 1, context->top_count);
     }
 
-    if (mem_percent == -1) {
-        unsigned long used_ram;
-        struct sysinfo meminfo;
-        sysinfo(&meminfo);
+    context->top_threshold = (num_top == context->top_count) ?
+        context->top[num_top - 1].bytes : 0;
 
-        used_ram = meminfo.totalram - meminfo.freeram -
-            meminfo.sharedram - meminfo.bufferram;
-        mem_percent = 100.0 * used_ram / meminfo.totalram;
+    /* names are only read for the few processes shown,
+     * so that a reused pid never shows a stale one */
+    g_string_truncate(context->top_string, 0);
+    for (guint idx = 0; idx < num_top; idx++) {
+        gssize size = _j4status_mem_process_read(context, context->top[idx].pid,
+            "comm", buffer);
+        if (size <= 0)
+            continue;
+        buffer[MIN((gsize) size, COMM_SIZE - 1)] = '\0';
+        gchar *formatted = g_format_size_full(context->top[idx].bytes,
+            G_FORMAT_SIZE_IEC_UNITS);
+        g_string_append_printf(context->top_string, "%s%s %s",
+            context->top_string->len > 0 ? ", " : "", g_strchomp(buffer),
+            formatted);
+        g_free(formatted);
     }
+}
 
-    j4status_section_set_state(context->section,
+/*
+ * Reads the first numbers of a sysfs or debugfs file
+ * Returns FALSE on error
+ */
+static gboolean
+_j4status_mem_read_numbers(gint fd, guint64 *values, guint count)
+{
+    gchar buffer[ZRAM_FILE_SIZE];
+    gssize size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0)
+        return FALSE;
+    buffer[size] = '\0';
+    const gchar *marker = buffer;
+    for (guint idx = 0; idx < count; idx++)
+        marker = _j4status_mem_scan_number(marker, &values[idx]);
+    return TRUE;
+}
+
+/*
+ * Opens the mm_stat of all zram devices
+ * They are only looked for on start: swap devices rarely come and go
+ */
+static void
+_j4status_mem_zram_open(J4statusPluginContext *context)
+{
+    GDir *dir = g_dir_open(SYS_BLOCK, 0, NULL);
+    const gchar *entry;
+    while (dir && (entry = g_dir_read_name(dir))) {
+        if (!g_str_has_prefix(entry, "zram"))
+            continue;
+        gchar *path = g_build_filename(SYS_BLOCK, entry, "mm_stat", NULL);
+        gint fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+            g_array_append_val(context->zram_fds, fd);
+        else
+            g_warning("Could not open %s: %s", path, g_strerror(errno));
+        g_free(path);
+    }
+    if (dir)
+        g_dir_close(dir);
+}
+
+/*
+ * Sums the mm_stat of all zram devices, in bytes:
+ * data stored, its compressed size and the memory used for it,
+ * allocator overhead included
+ * Returns FALSE if there is no device
+ */
+static gboolean
+_j4status_mem_zram_read(J4statusPluginContext *context, guint64 *orig,
+    guint64 *compr, guint64 *used)
+{
+    gboolean found = FALSE;
+    *orig = *compr = *used = 0;
+    for (guint idx = 0; idx < context->zram_fds->len; idx++) {
+        guint64 values[3];
+        if (!_j4status_mem_read_numbers(
+                g_array_index(context->zram_fds, gint, idx), values, 3))
+            continue;
+        *orig += values[0];
+        *compr += values[1];
+        *used += values[2];
+        found = TRUE;
+    }
+    return found;
+}
+
+/*
+ * Gets the zswap pool size and what is in it, in bytes,
+ * from PROC_MEMINFO or debugfs on older kernels
+ * Returns FALSE if neither has it
+ */
+static gboolean
+_j4status_mem_zswap_read(J4statusPluginContext *context, guint64 *orig,
+    guint64 *compr)
+{
+    const J4statusMemFile *meminfo = &context->meminfo;
+    if ((meminfo->missing & ZSWAP_ENTRIES) == 0) {
+        *orig = meminfo->values[MEM_ZSWAPPED] * 1024;
+        *compr = meminfo->values[MEM_ZSWAP] * 1024;
+        return TRUE;
+    }
+    if (context->zswap_pool_fd < 0 || context->zswap_stored_fd < 0 ||
+        !_j4status_mem_read_numbers(context->zswap_pool_fd, compr, 1) ||
+        !_j4status_mem_read_numbers(context->zswap_stored_fd, orig, 1))
+        return FALSE;
+    *orig *= sysconf(_SC_PAGESIZE);
+    return TRUE;
+}
+
+/*
+ * Fills the zram and zswap tokens that can be
+ * Ratios are of the uncompressed size to the memory actually used
+ */
+static void
+_j4status_mem_compression_update(J4statusPluginContext *context,
+    struct J4statusMemFormatData *fdata)
+{
+    guint64 orig, compr, used;
+    if ((context->used_tokens & ZRAM_TOKENS) &&
+        _j4status_mem_zram_read(context, &orig, &compr, &used)) {
+        fdata->bytes[TOKEN_ZRAM_ORIG] = orig;
+        fdata->bytes[TOKEN_ZRAM_COMPR] = compr;
+        fdata->bytes[TOKEN_ZRAM_USED] = used;
+        fdata->bytes[TOKEN_ZRAM_SAVED] = orig - MIN(used, orig);
+        fdata->ratios[TOKEN_ZRAM_RATIO] = used > 0 ? 1.0 * orig / used : 0;
+        fdata->set_tokens |= ZRAM_TOKENS;
+    }
+    if ((context->used_tokens & ZSWAP_TOKENS) &&
+        _j4status_mem_zswap_read(context, &orig, &compr)) {
+        fdata->bytes[TOKEN_ZSWAP_ORIG] = orig;
+        fdata->bytes[TOKEN_ZSWAP_COMPR] = compr;
+        fdata->bytes[TOKEN_ZSWAP_SAVED] = orig - MIN(compr, orig);
+        fdata->ratios[TOKEN_ZSWAP_RATIO] = compr > 0 ? 1.0 * orig / compr : 0;
+        fdata->set_tokens |= ZSWAP_TOKENS;
+    }
+}
+
+/*
+ * J4statusFormatStringReplaceCallback instance
+ * Sizes are in bytes, so that the b flag gives binary prefixes
+ */
+static GVariant *
+_j4status_mem_format_callback(G_GNUC_UNUSED const gchar *token,
+    guint64 value, gconstpointer user_data)
+{
+    const struct J4statusMemFormatData *fdata = user_data;
+    if (((ZRAM_TOKENS | ZSWAP_TOKENS) & TOKEN_FLAG(value)) &&
+        (fdata->set_tokens & TOKEN_FLAG(value)) == 0)
+        return NULL;
+    switch (value) {
+    case TOKEN_USED_RATIO:
+    case TOKEN_SWAP_USED_RATIO:
+    case TOKEN_ZRAM_RATIO:
+    case TOKEN_ZSWAP_RATIO:
+        return g_variant_new_double(fdata->ratios[value]);
+    case TOKEN_SWAP_IN:
+    case TOKEN_SWAP_OUT:
+    case TOKEN_MAJOR_FAULTS:
+    case TOKEN_SCANNED:
+    case TOKEN_RECLAIMED:
+        return g_variant_new_double(fdata->rates[value]);
+    case TOKEN_OOM_KILLS:
+        return g_variant_new_uint64(fdata->oom_kills);
+    case TOKEN_TOP:
+        if (fdata->top == NULL)
+            return NULL;
+        return g_variant_new_string(fdata->top);
+    default:
+        if (value >= TOTAL_TOKEN_COUNT)
+            return NULL;
+        return g_variant_new_uint64(fdata->bytes[value]);
+    }
+}
+
+static gboolean
+_j4status_mem_update(gpointer user_data)
+{
+    J4statusPluginContext *context = user_data;
+
+    if (!_j4status_mem_meminfo_read(context)) {
+        j4status_section_set_state(context->section, J4STATUS_STATE_BAD);
+        return G_SOURCE_CONTINUE;
+    }
+    gdouble vm_rates[VM_ENTRY_COUNT] = { 0 };
+    guint64 oom_kills = 0;
+    if (context->vmstat.fd >= 0)
+        _j4status_mem_vmstat_read(context, vm_rates, &oom_kills);
+    context->oom_kills += oom_kills;
+
+    const guint64 *values = context->meminfo.values;
+    guint64 total = values[MEM_TOTAL];
+    guint64 available = MIN(values[MEM_AVAILABLE], total);
+    double mem_percent = 100.0 * (total - available) / total;
+    guint64 swap_used = values[MEM_SWAP_TOTAL] -
+        MIN(values[MEM_SWAP_FREE], values[MEM_SWAP_TOTAL]);
+    guint64 huge_used = values[MEM_HUGE_TOTAL] -
+        MIN(values[MEM_HUGE_FREE], values[MEM_HUGE_TOTAL]);
+
+    /* meminfo is in kB, vmstat in pages */
+    struct J4statusMemFormatData fdata = {
+        .bytes = {
+            [TOKEN_USED]       = (total - available) * 1024,
+            [TOKEN_AVAILABLE]  = available * 1024,
+            [TOKEN_TOTAL]      = total * 1024,
+            [TOKEN_SWAP_USED]  = swap_used * 1024,
+            [TOKEN_SWAP_TOTAL] = values[MEM_SWAP_TOTAL] * 1024,
+            [TOKEN_CACHED]     = values[MEM_CACHED] * 1024,
+            [TOKEN_BUFFERS]    = values[MEM_BUFFERS] * 1024,
+            [TOKEN_DIRTY]      = values[MEM_DIRTY] * 1024,
+            [TOKEN_WRITEBACK]  = values[MEM_WRITEBACK] * 1024,
+            [TOKEN_SHMEM]      = values[MEM_SHMEM] * 1024,
+            [TOKEN_HUGE_USED]  = huge_used * values[MEM_HUGE_SIZE] * 1024,
+            [TOKEN_HUGE_TOTAL] = values[MEM_HUGE_TOTAL] *
+                values[MEM_HUGE_SIZE] * 1024,
+        },
+        .ratios = {
+            [TOKEN_USED_RATIO]      = mem_percent,
+            [TOKEN_SWAP_USED_RATIO] = values[MEM_SWAP_TOTAL] > 0 ?
+                100.0 * swap_used / values[MEM_SWAP_TOTAL] : 0,
+        },
+        .rates = {
+            [TOKEN_SWAP_IN]      = vm_rates[VM_PSWPIN],
+            [TOKEN_SWAP_OUT]     = vm_rates[VM_PSWPOUT],
+            [TOKEN_MAJOR_FAULTS] = vm_rates[VM_PGMAJFAULT],
+            [TOKEN_SCANNED]      = vm_rates[VM_PGSCAN_KSWAPD] +
+                vm_rates[VM_PGSCAN_DIRECT] + vm_rates[VM_PGSCAN_KHUGEPAGED],
+            [TOKEN_RECLAIMED]    = vm_rates[VM_PGSTEAL_KSWAPD] +
+                vm_rates[VM_PGSTEAL_DIRECT] +
+                vm_rates[VM_PGSTEAL_KHUGEPAGED],
+        },
+        .oom_kills = context->oom_kills,
+    };
+    if (context->proc_fd >= 0) {
+        _j4status_mem_top_update(context);
+        fdata.top = context->top_string->str;
+    }
+    _j4status_mem_compression_update(context, &fdata);
+
+    J4statusState state =
         mem_percent < context->good_threshold ? J4STATUS_STATE_GOOD :
         mem_percent > context->bad_threshold ? J4STATUS_STATE_BAD :
-            J4STATUS_STATE_AVERAGE);
+            J4STATUS_STATE_AVERAGE;
+    /* thrashing, or about to */
+    if (oom_kills > 0 ||
+        (context->bad_major_faults > 0 &&
+            vm_rates[VM_PGMAJFAULT] > context->bad_major_faults) ||
+        (context->bad_swap_out > 0 &&
+            vm_rates[VM_PSWPOUT] > context->bad_swap_out))
+        state = J4STATUS_STATE_BAD;
+    j4status_section_set_state(context->section, state);
     j4status_section_set_value(context->section,
-        g_strdup_printf("%04.1f%%", mem_percent));
+        j4status_format_string_replace(context->format,
+            _j4status_mem_format_callback, &fdata));
+    _j4status_mem_nodes_update(context);
+    g_slist_foreach(context->cgroups, _j4status_mem_cgroup_update, NULL);
 
     return G_SOURCE_CONTINUE;
 }
 
 // static void _j4status_mem_uninit(J4statusPluginContext *context);
 
+/*
+ * Parses a kernel cpu/node list, e.g. "0-1,4"
+ * Returns the ids, in a newly allocated array of *count
+ */
+static guint *
+_j4status_mem_parse_list(const gchar *list, guint *count)
+{
+    GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint));
+    const gchar *marker = list;
+    while (*marker >= '0' && *marker <= '9') {
+        guint64 first, last;
+        marker = _j4status_mem_scan_number(marker, &first);
+        last = first;
+        if (*marker == '-')
+            marker = _j4status_mem_scan_number(marker + 1, &last);
+        for (guint64 id = first; id <= last; id++) {
+            guint value = id;
+            g_array_append_val(ids, value);
+        }
+        if (*marker == ',')
+            marker++;
+    }
+    *count = ids->len;
+    return (guint *) g_array_free(ids, FALSE);
+}
+
+/*
+ * Creates the NUMA node sections
+ * The node list is only read here, nodes do not come and go
+ */
+static void
+_j4status_mem_add_nodes(J4statusPluginContext *context,
+    J4statusCoreInterface *core)
+{
+    gchar *online;
+    if (!g_file_get_contents(NODE_ONLINE, &online, NULL, NULL)) {
+        g_message("mem: No NUMA node found");
+        return;
+    }
+    guint count;
+    guint *ids = _j4status_mem_parse_list(online, &count);
+    g_free(online);
+
+    context->nodes = g_new0(J4statusMemNode, count);
+    for (guint idx = 0; idx < count; idx++) {
+        J4statusMemNode *node = &context->nodes[context->num_nodes];
+        gchar *instance = g_strdup_printf("%u", ids[idx]);
+        node->section = j4status_section_new(core);
+        j4status_section_set_name(node->section, "mem");
+        j4status_section_set_instance(node->section, instance);
+        if (!j4status_section_insert(node->section)) {
+            j4status_section_free(node->section);
+            g_free(instance);
+            continue;
+        }
+        /* lines start with "Node <id> " */
+        node->path = g_strdup_printf(NODE_MEMINFO, ids[idx]);
+        _j4status_mem_file_init(&node->meminfo, node->path,
+            _j4status_mem_node_keys, NODE_ENTRY_COUNT,
+            strlen("Node ") + strlen(instance) + 1, ':', NODE_MEMINFO_SIZE);
+        node->meminfo.wanted = ENTRY_FLAG(NODE_TOTAL) |
+            ENTRY_FLAG(NODE_FREE);
+        for (guint token = 0; token < NODE_TOKEN_COUNT; token++) {
+            if (context->node_used_tokens & TOKEN_FLAG(token))
+                node->meminfo.wanted |=
+                    _j4status_mem_node_token_entries[token];
+        }
+        g_free(instance);
+        context->num_nodes++;
+    }
+    g_free(ids);
+    if (context->node_used_tokens & NODE_HUGE_TOKENS)
+        context->meminfo.wanted |= ENTRY_FLAG(MEM_HUGE_SIZE);
+}
+
+/*
+ * Creates and inserts a section for a cgroup
+ * "path" is relative to the cgroup v2 hierarchy root
+ */
+static void
+_j4status_mem_add_cgroup(J4statusPluginContext *context,
+    J4statusCoreInterface *core, const gchar *path)
+{
+    J4statusMemCGroup *cgroup = g_new0(J4statusMemCGroup, 1);
+    cgroup->context = context;
+    for (guint file = 0; file < CGROUP_FILE_COUNT; file++)
+        cgroup->fds[file] = -1;
+    cgroup->path = g_build_filename(CGROUP_ROOT, path, NULL);
+    cgroup->events_path = g_build_filename(cgroup->path, "memory.events",
+        NULL);
+    _j4status_mem_file_init(&cgroup->events, cgroup->events_path,
+        _j4status_mem_event_keys, EVENT_ENTRY_COUNT, 0, ' ', EVENTS_SIZE);
+    cgroup->events.wanted = ENTRY_FLAG(EVENT_HIGH) | ENTRY_FLAG(EVENT_OOM_KILL);
+    cgroup->section = j4status_section_new(core);
+    j4status_section_set_name(cgroup->section, "mem-cgroup");
+    j4status_section_set_instance(cgroup->section, path);
+    if (j4status_section_insert(cgroup->section))
+        context->cgroups = g_slist_prepend(context->cgroups, cgroup);
+    else
+        _j4status_mem_cgroup_free(cgroup);
+}
+
 static J4statusPluginContext *
 _j4status_mem_init(J4statusCoreInterface *core)
 {
     const gchar MEM[]= "Memory";
+    const gchar FORMAT_DEFAULT[] = "${p_used(f04.1)}%";
+    const gchar CGROUP_FORMAT_DEFAULT[] = "${usage(b.1)}B${max:+/${max(b.1)}B}";
     GKeyFile *key_file = j4status_config_get_key_file(MEM);
     guint period = 0;
     guint good_threshold = 0;
     guint bad_threshold = 0;
+    gdouble bad_major_faults = 0;
+    gdouble bad_swap_out = 0;
+    gchar *format = NULL;
+    gboolean per_node = FALSE;
+    gchar *node_format = NULL;
+    gchar **cgroups = NULL;
+    gchar *cgroup_format = NULL;
+    gint top_count = 0;
+    gchar *top_by = NULL;
+    guint top_pss_frequency = 0;
     if (key_file) {
         period = g_key_file_get_integer(key_file, MEM, "Frequency", NULL);
         good_threshold = g_key_file_get_integer(
             key_file, MEM, "GoodThreshold", NULL);
         bad_threshold = g_key_file_get_integer(
             key_file, MEM, "BadThreshold", NULL);
+        bad_major_faults = g_key_file_get_double(
+            key_file, MEM, "BadMajorFaults", NULL);
+        bad_swap_out = g_key_file_get_double(
+            key_file, MEM, "BadSwapOut", NULL);
+        format = g_key_file_get_locale_string(
+            key_file, MEM, "Format", NULL, NULL);
+        per_node = g_key_file_get_boolean(key_file, MEM, "PerNode", NULL);
+        node_format = g_key_file_get_locale_string(
+            key_file, MEM, "NodeFormat", NULL, NULL);
+        cgroups = g_key_file_get_string_list(
+            key_file, MEM, "CGroups", NULL, NULL);
+        cgroup_format = g_key_file_get_locale_string(
+            key_file, MEM, "CGroupFormat", NULL, NULL);
+        top_count = g_key_file_get_integer(key_file, MEM, "TopCount", NULL);
+        top_by = g_key_file_get_string(key_file, MEM, "TopBy", NULL);
+        top_pss_frequency = g_key_file_get_integer(
+            key_file, MEM, "TopPssFrequency", NULL);
         g_key_file_free(key_file);
     }
 
@@ -88,15 +1652,83 @@ _j4status_mem_init(J4statusCoreInterface *core)
     j4status_section_set_name(section, "mem");
     if (!j4status_section_insert(section)) {
         j4status_section_free(section);
+        g_free(format);
+        g_free(node_format);
+        g_strfreev(cgroups);
+        g_free(cgroup_format);
+        g_free(top_by);
         return NULL;
     }
 
-    J4statusPluginContext *context = g_new(J4statusPluginContext, 1);
+    J4statusPluginContext *context = g_new0(J4statusPluginContext, 1);
     context->section = section;
     context->good_threshold = good_threshold > 0 ? good_threshold : 50;
     context->bad_threshold = bad_threshold > context->good_threshold ?
         bad_threshold : 90;
+    context->bad_major_faults = MAX(bad_major_faults, 0);
+    context->bad_swap_out = MAX(bad_swap_out, 0);
     context->period = MAX(period, 1);
+    context->timeout_id = 0;
+    context->format = j4status_format_string_parse(format,
+        _j4status_mem_tokens, TOTAL_TOKEN_COUNT, FORMAT_DEFAULT,
+        &context->used_tokens);
+
+    context->proc_fd = -1;
+    context->loadavg_fd = -1;
+    context->zram_fds = g_array_new(FALSE, FALSE, sizeof(gint));
+    context->zswap_pool_fd = -1;
+    context->zswap_stored_fd = -1;
+    if (context->used_tokens & TOKEN_FLAG(TOKEN_TOP)) {
+        context->top_count = top_count > 0 ? top_count : 3;
+        context->top_by_pss = (g_strcmp0(top_by, "pss") == 0);
+        /* PSS every 30s by default */
+        context->pss_period = MAX((top_pss_frequency > 0 ?
+            top_pss_frequency : 30) / context->period, 1);
+        context->page_size = MAX(sysconf(_SC_PAGESIZE), 1);
+        context->dents = g_new(gchar, DENTS_SIZE);
+        /* enough for a desktop, it grows on the first tick otherwise */
+        context->processes = g_array_sized_new(FALSE, FALSE,
+            sizeof(J4statusMemProcess), 1024);
+        context->top = g_new0(J4statusMemTopEntry, context->top_count);
+        context->top_string = g_string_new(NULL);
+    }
+    g_free(top_by);
+
+    _j4status_mem_file_init(&context->meminfo, PROC_MEMINFO,
+        _j4status_mem_keys, MEM_ENTRY_COUNT, 0, ':', MEMINFO_SIZE);
+    _j4status_mem_file_init(&context->vmstat, PROC_VMSTAT,
+        _j4status_mem_vm_keys, VM_ENTRY_COUNT, 0, ' ', VMSTAT_SIZE);
+    context->meminfo.wanted = ENTRY_FLAG(MEM_TOTAL) |
+        ENTRY_FLAG(MEM_AVAILABLE);
+    for (guint token = 0; token < TOTAL_TOKEN_COUNT; token++) {
+        if (context->used_tokens & TOKEN_FLAG(token)) {
+            context->meminfo.wanted |= _j4status_mem_token_entries[token];
+            context->vmstat.wanted |= _j4status_mem_token_vm_entries[token];
+        }
+    }
+    if (context->bad_major_faults > 0)
+        context->vmstat.wanted |= ENTRY_FLAG(VM_PGMAJFAULT);
+    if (context->bad_swap_out > 0)
+        context->vmstat.wanted |= ENTRY_FLAG(VM_PSWPOUT);
+    /* OOM kills always make the section bad */
+    context->vmstat.wanted |= ENTRY_FLAG(VM_OOM_KILL);
+
+    if (per_node) {
+        context->node_format = j4status_format_string_parse(node_format,
+            _j4status_mem_node_tokens, NODE_TOKEN_COUNT, FORMAT_DEFAULT,
+            &context->node_used_tokens);
+        _j4status_mem_add_nodes(context, core);
+    } else {
+        g_free(node_format);
+    }
+
+    context->cgroup_format = j4status_format_string_parse(cgroup_format,
+        _j4status_mem_cgroup_tokens, CGROUP_TOKEN_COUNT,
+        CGROUP_FORMAT_DEFAULT, &context->cgroup_used_tokens);
+    for (gchar **cgroup = cgroups; cgroup && *cgroup; cgroup++)
+        _j4status_mem_add_cgroup(context, core, *cgroup);
+    g_strfreev(cgroups);
+    context->cgroups = g_slist_reverse(context->cgroups);
     return context;
 }
 
@@ -104,12 +1736,61 @@ static void
 _j4status_mem_uninit(J4statusPluginContext *context)
 {
     g_free(context->section);
+    j4status_format_string_unref(context->format);
+    _j4status_mem_file_clear(&context->meminfo);
+    _j4status_mem_file_clear(&context->vmstat);
+    for (guint idx = 0; idx < context->num_nodes; idx++) {
+        j4status_section_free(context->nodes[idx].section);
+        _j4status_mem_file_clear(&context->nodes[idx].meminfo);
+        g_free(context->nodes[idx].path);
+    }
+    g_free(context->nodes);
+    if (context->node_format)
+        j4status_format_string_unref(context->node_format);
+    g_slist_free_full(context->cgroups, _j4status_mem_cgroup_free);
+    j4status_format_string_unref(context->cgroup_format);
+    g_free(context->dents);
+    if (context->processes)
+        g_array_free(context->processes, TRUE);
+    g_free(context->top);
+    if (context->top_string)
+        g_string_free(context->top_string, TRUE);
+    g_array_free(context->zram_fds, TRUE);
     g_free(context);
 }
 
 static void
 _j4status_mem_start(J4statusPluginContext *context)
 {
+    if (!_j4status_mem_file_open(&context->meminfo)) {
+        j4status_section_set_state(context->section,
+            J4STATUS_STATE_UNAVAILABLE);
+        return;
+    }
+    if (context->vmstat.wanted != 0)
+        _j4status_mem_file_open(&context->vmstat);
+    for (guint idx = 0; idx < context->num_nodes; idx++)
+        _j4status_mem_file_open(&context->nodes[idx].meminfo);
+    if (context->top_string) {
+        context->proc_fd = open(PROC, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (context->proc_fd < 0)
+            g_warning("Could not open %s: %s", PROC, g_strerror(errno));
+        else
+            context->loadavg_fd = openat(context->proc_fd, "loadavg",
+                O_RDONLY | O_CLOEXEC);
+        /* a full scan on the first tick */
+        context->last_pid = 0;
+    }
+    if (context->used_tokens & ZRAM_TOKENS)
+        _j4status_mem_zram_open(context);
+    /* quietly, debugfs being root only is the common case */
+    if (context->used_tokens & ZSWAP_TOKENS) {
+        context->zswap_pool_fd = open(ZSWAP_POOL_SIZE, O_RDONLY | O_CLOEXEC);
+        context->zswap_stored_fd = open(ZSWAP_STORED_PAGES,
+            O_RDONLY | O_CLOEXEC);
+    }
+    context->vm_time = 0;
+    context->oom_kills = 0;
     _j4status_mem_update(context);
     context->timeout_id = g_timeout_add_seconds(
         context->period, _j4status_mem_update, context);
@@ -118,8 +1799,29 @@ _j4status_mem_start(J4statusPluginContext *context)
 static void
 _j4status_mem_stop(J4statusPluginContext *context)
 {
-    g_source_remove(context->timeout_id);
+    if (context->timeout_id > 0)
+        g_source_remove(context->timeout_id);
     context->timeout_id = 0;
+    _j4status_mem_file_close(&context->meminfo);
+    _j4status_mem_file_close(&context->vmstat);
+    for (guint idx = 0; idx < context->num_nodes; idx++)
+        _j4status_mem_file_close(&context->nodes[idx].meminfo);
+    g_slist_foreach(context->cgroups, _j4status_mem_cgroup_close, NULL);
+    if (context->loadavg_fd >= 0)
+        close(context->loadavg_fd);
+    context->loadavg_fd = -1;
+    if (context->proc_fd >= 0)
+        close(context->proc_fd);
+    context->proc_fd = -1;
+    for (guint idx = 0; idx < context->zram_fds->len; idx++)
+        close(g_array_index(context->zram_fds, gint, idx));
+    g_array_set_size(context->zram_fds, 0);
+    if (context->zswap_pool_fd >= 0)
+        close(context->zswap_pool_fd);
+    context->zswap_pool_fd = -1;
+    if (context->zswap_stored_fd >= 0)
+        close(context->zswap_stored_fd);
+    context->zswap_stored_fd = -1;
 }
 
 void
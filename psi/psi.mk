@@ -0,0 +1,20 @@
+plugins_LTLIBRARIES += \
+	psi/psi.la
+
+man5_MANS += \
+	psi/man/j4status-psi.conf.5
+
+psi_psi_la_SOURCES = \
+	psi/src/psi.c
+
+psi_psi_la_CFLAGS = \
+	$(AM_CFLAGS) \
+	$(PSI_PLUGIN_CFLAGS)
+
+psi_psi_la_LDFLAGS = \
+	$(AM_LDFLAGS) \
+	-module -avoid-version -export-symbols-regex j4status_input
+
+psi_psi_la_LIBADD = \
+	$(J4STATUS_PLUGIN_LIBS) \
+	$(PSI_PLUGIN_LIBS)
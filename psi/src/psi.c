@@ -0,0 +1,501 @@
+/*
+ * psi - j4status plugin for pressure stall information
+ *
+ * Copyright 2026 j4status-plugins contributors
+ *
+ * This file is part of j4status-plugins.
+ *
+ * j4status-plugins is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * j4status-plugins is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with j4status-plugins. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <glib.h>
+#include <glib-unix.h> // g_unix_fd_add()
+#include <j4status-plugin-input.h>
+
+#include <errno.h> // errno
+#include <fcntl.h> // open()
+#include <string.h> // strchr(), strlen(), strncmp()
+#include <unistd.h> // access(), pread(), write(), close()
+
+/// implementation of J4statusPluginContext
+struct _J4statusPluginContext
+{
+    GSList *sections;
+    gboolean started;
+    guint period; // polling, in seconds
+    J4statusFormatString *format;
+    guint64 used_tokens;
+    gchar *trigger; // written to the files, e.g. "some 100000 2000000"
+    gdouble average_threshold;
+    gdouble bad_threshold;
+};
+
+/// derived from J4statusSection
+typedef struct
+{
+    J4statusPluginContext *context;
+    J4statusSection *section;
+    gchar *path;
+    gint fd;
+    gboolean triggered; // whether the kernel watches the stall threshold
+    guint watch_id; // POLLPRI on fd
+    guint timeout_id; // polling, every "period" seconds, or two while
+                      // the pressure goes down after a trigger
+    gboolean fast; // polling every two seconds
+    gchar buffer[256]; // two lines, way shorter than that
+} J4statusPSISection;
+
+/// averages are updated every two seconds
+#define PSI_AVERAGE_PERIOD 2
+/// some_avg10 under which the pressure is gone (it is given with 2 decimals)
+#define PSI_IDLE 0.005
+
+/// pressure files directory
+#define PROC_PRESSURE_STR "/proc/pressure"
+const gchar PROC_PRESSURE[] = PROC_PRESSURE_STR;
+
+/// indices for _j4status_psi_tokens[]
+/// "some" and "full" tokens are in the same order
+enum J4statusPSIToken
+{
+    TOKEN_SOME_AVG10,
+    TOKEN_SOME_AVG60,
+    TOKEN_SOME_AVG300,
+    TOKEN_SOME_TOTAL,
+    TOKEN_FULL_AVG10,
+    TOKEN_FULL_AVG60,
+    TOKEN_FULL_AVG300,
+    TOKEN_FULL_TOTAL,
+
+    TOTAL_TOKEN_COUNT
+};
+
+/// used in j4status_format_string_parse()
+static const gchar *const _j4status_psi_tokens[] =
+{
+    [TOKEN_SOME_AVG10]  = "some_avg10",
+    [TOKEN_SOME_AVG60]  = "some_avg60",
+    [TOKEN_SOME_AVG300] = "some_avg300",
+    [TOKEN_SOME_TOTAL]  = "some_total",
+    [TOKEN_FULL_AVG10]  = "full_avg10",
+    [TOKEN_FULL_AVG60]  = "full_avg60",
+    [TOKEN_FULL_AVG300] = "full_avg300",
+    [TOKEN_FULL_TOTAL]  = "full_total",
+};
+
+/// data for _j4status_psi_format_callback()
+struct J4statusPSIFormatData
+{
+    guint64 set_tokens;
+    gdouble avg[TOTAL_TOKEN_COUNT]; // total tokens unused
+    guint64 total[TOTAL_TOKEN_COUNT]; // avg tokens unused
+};
+
+
+
+/**
+ * Parses a "some" or "full" line
+ * "avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+ * Returns the position right after the line
+ */
+static const gchar *
+_j4status_psi_parse_line(const gchar *marker,
+                         struct J4statusPSIFormatData *fdata, guint first)
+{
+    for (guint token = first; token < first + TOKEN_SOME_TOTAL; token++)
+      {
+        marker = strchr(marker, '=');
+        if (!marker) return NULL;
+        gchar *end;
+        fdata->avg[token] = g_ascii_strtod(marker + 1, &end);
+        marker = end;
+      }
+    marker = strchr(marker, '=');
+    if (!marker) return NULL;
+    guint64 total = 0;
+    for (marker++; *marker >= '0' && *marker <= '9'; marker++)
+        total = total * 10 + (guint64) (*marker - '0');
+    fdata->total[first + TOKEN_SOME_TOTAL] = total;
+    fdata->set_tokens |= 0xf << first;
+    while (*marker && *marker++ != '\n');
+    return marker;
+}
+
+/**
+ * J4statusFormatStringReplaceCallback instance
+ * Averages are percentages, totals are microseconds
+ */
+static GVariant *
+_j4status_psi_format_callback(G_GNUC_UNUSED const gchar *token, guint64 value,
+                              gconstpointer user_data)
+{
+    const struct J4statusPSIFormatData *fdata = user_data;
+    if (value >= TOTAL_TOKEN_COUNT || (fdata->set_tokens & 1 << value) == 0)
+        return NULL;
+    switch (value)
+      {
+        case TOKEN_SOME_TOTAL:
+        case TOKEN_FULL_TOTAL:
+            return g_variant_new_uint64(fdata->total[value]);
+        default:
+            return g_variant_new_double(fdata->avg[value]);
+      }
+}
+
+static gboolean _j4status_psi_section_poll(gpointer user_data);
+
+/**
+ * Reads the pressure file and updates the section
+ * Returns some_avg10, 0 on error
+ */
+static gdouble
+_j4status_psi_section_update(J4statusPSISection *section)
+{
+    J4statusPluginContext *context = section->context;
+    gssize size = pread(section->fd, section->buffer,
+                        sizeof(section->buffer) - 1, 0);
+    if (size < 0)
+      {
+        g_warning("Error reading %s: %s", section->path, g_strerror(errno));
+        j4status_section_set_state(section->section, J4STATUS_STATE_BAD);
+        j4status_section_set_value(section->section, g_strdup("Error"));
+        return 0;
+      }
+    section->buffer[size] = '\0';
+
+    struct J4statusPSIFormatData fdata = { .set_tokens = 0 };
+    const gchar *marker = section->buffer;
+    while (marker && *marker)
+      {
+        if (strncmp(marker, "some ", 5) == 0)
+            marker = _j4status_psi_parse_line(marker, &fdata,
+                                              TOKEN_SOME_AVG10);
+        else if (strncmp(marker, "full ", 5) == 0)
+            marker = _j4status_psi_parse_line(marker, &fdata,
+                                              TOKEN_FULL_AVG10);
+        else
+            break;
+      }
+    fdata.set_tokens &= context->used_tokens;
+
+    gdouble pressure = fdata.avg[TOKEN_SOME_AVG10];
+    j4status_section_set_state(section->section,
+                    pressure >= context->bad_threshold ? J4STATUS_STATE_BAD :
+                    pressure >= context->average_threshold ?
+                            J4STATUS_STATE_AVERAGE : J4STATUS_STATE_GOOD);
+    j4status_section_set_value(section->section,
+                               j4status_format_string_replace(context->format,
+                                       &_j4status_psi_format_callback, &fdata));
+    return pressure;
+}
+
+/**
+ * (Re)starts polling, every two seconds or every "period" seconds
+ */
+static void
+_j4status_psi_section_schedule(J4statusPSISection *section, gboolean fast)
+{
+    if (section->timeout_id)
+        g_source_remove(section->timeout_id);
+    section->fast = fast;
+    section->timeout_id = g_timeout_add_seconds(
+        fast ? PSI_AVERAGE_PERIOD : section->context->period,
+        &_j4status_psi_section_poll, section);
+}
+
+/**
+ * GUnixFDSourceFunc instance
+ * Called by the kernel when the stall threshold is crossed
+ * Polls every two seconds until the pressure is gone, since no event
+ * tells when it goes down
+ */
+static gboolean
+_j4status_psi_section_event(G_GNUC_UNUSED gint fd, GIOCondition condition,
+                            gpointer user_data)
+{
+    J4statusPSISection *section = user_data;
+    if (condition & G_IO_ERR)
+      {
+        g_warning("Trigger on %s was destroyed; polling instead",
+                  section->path);
+        section->triggered = FALSE;
+        section->watch_id = 0;
+        // polling goes on as it is
+        return G_SOURCE_REMOVE;
+      }
+    if (_j4status_psi_section_update(section) >= PSI_IDLE && !section->fast)
+        _j4status_psi_section_schedule(section, TRUE);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * GSourceFunc instance
+ * Called every "period" seconds, so that slower averages and totals
+ * keep up even without events,
+ * and every two seconds after a trigger until the pressure is gone
+ */
+static gboolean
+_j4status_psi_section_poll(gpointer user_data)
+{
+    J4statusPSISection *section = user_data;
+    gdouble pressure = _j4status_psi_section_update(section);
+    if (!section->fast || pressure >= PSI_IDLE)
+        return G_SOURCE_CONTINUE;
+    section->timeout_id = 0;
+    _j4status_psi_section_schedule(section, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * GFunc instance
+ * Opens the pressure file and registers the trigger
+ * Falls back to polling if triggers are not supported or not allowed
+ */
+static void
+_j4status_psi_section_start(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusPSISection *section = data;
+    J4statusPluginContext *context = section->context;
+
+    section->fd = open(section->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (section->fd >= 0)
+      {
+        // the trigger string must include the final nul byte
+        if (write(section->fd, context->trigger,
+                  strlen(context->trigger) + 1) >= 0)
+            section->triggered = TRUE;
+        else
+          {
+            g_message("Could not register trigger on %s: %s; polling instead",
+                      section->path, g_strerror(errno));
+            close(section->fd);
+            section->fd = -1;
+          }
+      }
+    if (section->fd < 0)
+        section->fd = open(section->path, O_RDONLY | O_CLOEXEC);
+    if (section->fd < 0)
+      {
+        g_warning("Could not open %s: %s", section->path, g_strerror(errno));
+        j4status_section_set_state(section->section,
+                                   J4STATUS_STATE_UNAVAILABLE);
+        j4status_section_set_value(section->section, g_strdup("Error"));
+        return;
+      }
+
+    gdouble pressure = _j4status_psi_section_update(section);
+    if (section->triggered)
+        section->watch_id = g_unix_fd_add(section->fd, G_IO_PRI | G_IO_ERR,
+                                          &_j4status_psi_section_event,
+                                          section);
+    _j4status_psi_section_schedule(section, section->triggered
+                                            && pressure >= PSI_IDLE);
+}
+
+/**
+ * GFunc instance
+ * Drops the trigger (by closing the file) and timers
+ */
+static void
+_j4status_psi_section_stop(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    J4statusPSISection *section = data;
+    if (section->watch_id)
+        g_source_remove(section->watch_id);
+    section->watch_id = 0;
+    if (section->timeout_id)
+        g_source_remove(section->timeout_id);
+    section->timeout_id = 0;
+    section->fast = FALSE;
+    if (section->fd >= 0)
+        close(section->fd);
+    section->fd = -1;
+    section->triggered = FALSE;
+}
+
+/**
+ * GDestroyNotify instance
+ * Called on freeing section list
+ * or if failed to insert the section
+ */
+static void
+_j4status_psi_section_free(gpointer data)
+{
+    J4statusPSISection *section = data;
+    _j4status_psi_section_stop(section, NULL);
+    j4status_section_free(section->section);
+    g_free(section->path);
+    g_free(section);
+}
+
+
+
+/**
+ * J4statusPluginInitFunc instance
+ * Checks for PSI support, reads config, inits sections
+ */
+static J4statusPluginContext *
+_j4status_psi_init(J4statusCoreInterface *core)
+{
+    const gchar PSI[] = "PSI";
+    const gchar FORMAT_DEFAULT[] = "${some_avg10(f04.1)}%";
+    const gchar *const RESOURCES_DEFAULT[] = { "cpu", "memory", "io", NULL };
+
+    if (access(PROC_PRESSURE, R_OK) < 0)
+      {
+        g_message("No " PROC_PRESSURE_STR " (kernel without PSI?); aborting");
+        return NULL;
+      }
+
+    GKeyFile *key_file = j4status_config_get_key_file(PSI);
+    gchar **resources = NULL;
+    gchar *format = NULL;
+    gint period = 0;
+    gint stall = 0;
+    gint window = 0;
+    gdouble average_threshold = 0;
+    gdouble bad_threshold = 0;
+    if (key_file)
+      {
+        resources = g_key_file_get_string_list(key_file, PSI, "Resources",
+                                               NULL, NULL);
+        format = g_key_file_get_locale_string(key_file, PSI, "Format", NULL,
+                                              NULL);
+        period = g_key_file_get_integer(key_file, PSI, "Frequency", NULL);
+        stall = g_key_file_get_integer(key_file, PSI, "Stall", NULL);
+        window = g_key_file_get_integer(key_file, PSI, "Window", NULL);
+        average_threshold = g_key_file_get_double(key_file, PSI,
+                                                  "AverageThreshold", NULL);
+        bad_threshold = g_key_file_get_double(key_file, PSI, "BadThreshold",
+                                              NULL);
+        g_key_file_free(key_file);
+      }
+
+    J4statusPluginContext *context = g_new0(J4statusPluginContext, 1);
+    const gchar *const *resource = resources ?
+        (const gchar *const *) resources : RESOURCES_DEFAULT;
+    for (; *resource; resource++)
+      {
+        J4statusPSISection *section = g_new0(J4statusPSISection, 1);
+        section->context = context;
+        section->fd = -1;
+        section->path = g_build_filename(PROC_PRESSURE, *resource, NULL);
+        if (access(section->path, R_OK) < 0)
+          {
+            g_warning("No pressure information for %s", *resource);
+            g_free(section->path);
+            g_free(section);
+            continue;
+          }
+        section->section = j4status_section_new(core);
+        j4status_section_set_name(section->section, "psi");
+        j4status_section_set_instance(section->section, *resource);
+        j4status_section_set_label(section->section, *resource);
+        if (!j4status_section_insert(section->section))
+            _j4status_psi_section_free(section);
+        else
+            context->sections = g_slist_prepend(context->sections, section);
+      }
+    g_strfreev(resources);
+    if (!context->sections)
+      {
+        g_free(format);
+        g_free(context);
+        return NULL;
+      }
+    context->sections = g_slist_reverse(context->sections);
+
+    context->started = FALSE;
+    context->period = period > 0 ? period : 10;
+    // Unprivileged triggers need a window that is a multiple of 2s
+    if (window <= 0)
+        window = 2000;
+    // the trigger fires when the stall ratio reaches the average state,
+    // whichever of the two is set (5% if none)
+    if (stall <= 0)
+        stall = average_threshold > 0
+                ? MAX(1, (gint) (average_threshold * window / 100))
+                : window / 20;
+    context->trigger = g_strdup_printf("some %d %d", stall * 1000,
+                                       window * 1000);
+    context->average_threshold = average_threshold > 0 ? average_threshold
+                                 : 100.0 * stall / window;
+    context->bad_threshold = bad_threshold > context->average_threshold ?
+                             bad_threshold : MAX(40, context->average_threshold);
+    context->format = j4status_format_string_parse(format, _j4status_psi_tokens,
+                                                   TOTAL_TOKEN_COUNT,
+                                                   FORMAT_DEFAULT,
+                                                   &context->used_tokens);
+    return context;
+}
+
+/**
+ * J4statusPluginSimpleFunc instance
+ * Registers the triggers
+ */
+static void
+_j4status_psi_start(J4statusPluginContext *context)
+{
+    if (context->started) return;
+    context->started = TRUE;
+    g_slist_foreach(context->sections, &_j4status_psi_section_start, NULL);
+}
+
+/**
+ * J4statusPluginSimpleFunc instance
+ * Drops the triggers
+ */
+static void
+_j4status_psi_stop(J4statusPluginContext *context)
+{
+    if (!context->started) return;
+    context->started = FALSE;
+    g_slist_foreach(context->sections, &_j4status_psi_section_stop, NULL);
+}
+
+/**
+ * J4statusPluginSimpleFunc instance
+ * Cleans stuff up
+ */
+static void
+_j4status_psi_uninit(J4statusPluginContext *context)
+{
+    _j4status_psi_stop(context);
+    g_slist_free_full(context->sections, &_j4status_psi_section_free);
+    j4status_format_string_unref(context->format);
+    g_free(context->trigger);
+    g_free(context);
+}
+
+/**
+ * The exported function
+ * Inserts callbacks
+ */
+void
+j4status_input_plugin(J4statusInputPluginInterface *interface)
+{
+    libj4status_input_plugin_interface_add_init_callback(interface,
+                                                         _j4status_psi_init);
+    libj4status_input_plugin_interface_add_start_callback(interface,
+                                                          _j4status_psi_start);
+    libj4status_input_plugin_interface_add_stop_callback(interface,
+                                                         _j4status_psi_stop);
+    libj4status_input_plugin_interface_add_uninit_callback(interface,
+                                                         _j4status_psi_uninit);
+}